@@ -0,0 +1,109 @@
+#pragma once
+
+// Generator of dileptonic ttbar events at parton level (t -> W b, W -> l nu, on-shell at the given masses), shared by the
+// standalone binaries checking the neutrinos solver outside of any CMSSW event loop.
+
+#include <cp3_llbb/TTAnalysis/interface/NeutrinosSolver.h>
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+namespace DileptonTTbar {
+
+    using LorentzVector = NeutrinosSolver::LorentzVector;
+
+    const double b_mass = 4.8;
+
+    struct Event {
+        LorentzVector lepton1_p4, lepton2_p4;
+        LorentzVector bjet1_p4, bjet2_p4;
+        LorentzVector neutrino1_p4, neutrino2_p4;
+        LorentzVector met;
+    };
+
+    // Boost p from the rest frame of `parent` to the frame where `parent` is defined
+    inline LorentzVector boost(const LorentzVector& p, const LorentzVector& parent) {
+        const double bx = parent.Px() / parent.E();
+        const double by = parent.Py() / parent.E();
+        const double bz = parent.Pz() / parent.E();
+        const double b2 = bx*bx + by*by + bz*bz;
+        const double gamma = 1. / std::sqrt(1. - b2);
+        const double bp = bx*p.Px() + by*p.Py() + bz*p.Pz();
+        const double gamma2 = b2 > 0 ? (gamma - 1.) / b2 : 0.;
+
+        return LorentzVector(p.Px() + gamma2*bp*bx + gamma*bx*p.E(),
+                p.Py() + gamma2*bp*by + gamma*by*p.E(),
+                p.Pz() + gamma2*bp*bz + gamma*bz*p.E(),
+                gamma * (p.E() + bp));
+    }
+
+    class EventGenerator {
+        public:
+            EventGenerator(double top_mass, double w_mass, uint64_t seed):
+                m_rng(seed), t_mass(top_mass), w_mass(w_mass) {
+                // Empty
+            }
+
+            Event generate() {
+                Event event;
+
+                // ttbar system at rest in the transverse plane, with exponentially falling top pt
+                const double pt = -80. * std::log(1. - uniform());
+                const double phi = 2 * M_PI * uniform();
+                std::normal_distribution<double> rapidity(0., 1.2);
+
+                const LorentzVector top1 = top(pt * std::cos(phi), pt * std::sin(phi), rapidity(m_rng));
+                const LorentzVector top2 = top(-pt * std::cos(phi), -pt * std::sin(phi), rapidity(m_rng));
+
+                decay(top1, event.lepton1_p4, event.bjet1_p4, event.neutrino1_p4);
+                decay(top2, event.lepton2_p4, event.bjet2_p4, event.neutrino2_p4);
+
+                const LorentzVector neutrinos = event.neutrino1_p4 + event.neutrino2_p4;
+                event.met = LorentzVector(neutrinos.Px(), neutrinos.Py(), 0., neutrinos.Pt());
+
+                return event;
+            }
+
+        private:
+            double uniform() {
+                return std::uniform_real_distribution<double>(0., 1.)(m_rng);
+            }
+
+            LorentzVector top(double px, double py, double y) const {
+                const double mT = std::sqrt(t_mass*t_mass + px*px + py*py);
+                return LorentzVector(px, py, mT * std::sinh(y), mT * std::cosh(y));
+            }
+
+            // Isotropic momentum of norm p and mass m
+            LorentzVector isotropic(double p, double m) {
+                const double cos_theta = 2. * uniform() - 1.;
+                const double sin_theta = std::sqrt(1. - cos_theta*cos_theta);
+                const double phi = 2 * M_PI * uniform();
+                return LorentzVector(p * sin_theta * std::cos(phi), p * sin_theta * std::sin(phi), p * cos_theta, std::sqrt(p*p + m*m));
+            }
+
+            static double twoBodyMomentum(double M, double m1, double m2) {
+                return std::sqrt((M*M - (m1 + m2)*(m1 + m2)) * (M*M - (m1 - m2)*(m1 - m2))) / (2. * M);
+            }
+
+            void decay(const LorentzVector& top, LorentzVector& lepton, LorentzVector& b, LorentzVector& neutrino) {
+                // t -> W b in the top rest frame
+                const LorentzVector w = isotropic(twoBodyMomentum(t_mass, w_mass, b_mass), w_mass);
+                b = LorentzVector(-w.Px(), -w.Py(), -w.Pz(), std::sqrt(SQ(w.P()) + SQ(b_mass)));
+
+                // W -> l nu in the W rest frame
+                const LorentzVector l = isotropic(w_mass / 2., 0.);
+                const LorentzVector nu(-l.Px(), -l.Py(), -l.Pz(), l.E());
+
+                lepton = boost(boost(l, w), top);
+                neutrino = boost(boost(nu, w), top);
+                b = boost(b, top);
+            }
+
+            std::mt19937_64 m_rng;
+            double t_mass;
+            double w_mass;
+    };
+
+}
@@ -0,0 +1,349 @@
+// Standalone benchmark and accuracy check of the neutrinos solver, outside of any CMSSW event loop.
+//
+// Generates dileptonic ttbar events at parton level (t -> W b, W -> l nu, on-shell at the masses given to the solver),
+// then measures the throughput of the different entry points of the solver, and the accuracy of the solutions:
+// the top and W masses reconstructed from the solutions are compared to the input masses, and the solution closest
+// to the generated neutrinos is looked for. This is done for the double and single precision versions of the solver.
+//
+// Usage: ttNeutrinosSolverBenchmark [n_events=100000] [seed=42] [top_mass=172.5] [w_mass=80.419002]
+
+#include <cp3_llbb/TTAnalysis/interface/NeutrinosSolver.h>
+
+#include "DileptonTTbarGenerator.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using LorentzVector = NeutrinosSolver::LorentzVector;
+using DileptonTTbar::Event;
+using DileptonTTbar::EventGenerator;
+
+namespace {
+
+    class Timer {
+        public:
+            Timer(): m_start(std::chrono::steady_clock::now()) {}
+
+            double seconds() const {
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+            }
+
+        private:
+            std::chrono::steady_clock::time_point m_start;
+    };
+
+    void printThroughput(const std::string& name, size_t n_calls, double seconds, size_t n_solutions) {
+        std::cout << "  " << std::left << std::setw(40) << name << std::right
+            << std::setw(12) << std::setprecision(4) << n_calls / seconds << " calls/s"
+            << std::setw(10) << std::setprecision(4) << seconds / n_calls * 1e9 << " ns/call"
+            << "   (" << n_solutions << " solutions)" << std::endl;
+    }
+
+    // Accumulates the distribution of a residual
+    struct Residual {
+        size_t n = 0;
+        double sum = 0;
+        double sum2 = 0;
+        double max = 0;
+
+        void fill(double value) {
+            n++;
+            sum += value;
+            sum2 += value * value;
+            max = std::max(max, std::abs(value));
+        }
+
+        void print(const std::string& name) const {
+            const double mean = n ? sum / n : 0;
+            const double rms = n ? std::sqrt(sum2 / n) : 0;
+            std::cout << "  " << std::left << std::setw(40) << name << std::right << std::scientific << std::setprecision(3)
+                << "mean " << std::setw(11) << mean << "   rms " << std::setw(10) << rms << "   max |.| " << std::setw(10) << max
+                << std::endl;
+            std::cout.unsetf(std::ios::floatfield);
+        }
+    };
+
+    // Sum of the distances between the components of the two neutrinos of each pair
+    double distance(const NeutrinosSolver::NeutrinosPair& a, const LorentzVector& n1, const LorentzVector& n2) {
+        return std::abs(a.first.Px() - n1.Px()) + std::abs(a.first.Py() - n1.Py()) + std::abs(a.first.Pz() - n1.Pz()) +
+            std::abs(a.second.Px() - n2.Px()) + std::abs(a.second.Py() - n2.Py()) + std::abs(a.second.Pz() - n2.Pz());
+    }
+
+
+    // Residuals of the masses rebuilt from the solutions of `solver`, computed in double precision whatever the solver scalar type
+    template<typename Solver>
+    void printAccuracy(const std::string& title, Solver& solver, const std::vector<Event>& events, double t_mass, double w_mass) {
+        using SolverLorentzVector = typename Solver::LorentzVector;
+
+        Residual top1_residual, top2_residual, w1_residual, w2_residual, true_residual;
+        size_t n_no_solution = 0;
+
+        for (const Event& e: events) {
+            const auto solutions = solver.getNeutrinos(SolverLorentzVector(e.lepton1_p4), SolverLorentzVector(e.lepton2_p4),
+                    SolverLorentzVector(e.bjet1_p4), SolverLorentzVector(e.bjet2_p4), SolverLorentzVector(e.met));
+            if (solutions.empty()) {
+                n_no_solution++;
+                continue;
+            }
+
+            double closest = std::numeric_limits<double>::max();
+            for (const auto& solution: solutions) {
+                const NeutrinosSolver::NeutrinosPair neutrinos(LorentzVector(solution.first), LorentzVector(solution.second));
+
+                top1_residual.fill((e.lepton1_p4 + e.bjet1_p4 + neutrinos.first).M() - t_mass);
+                top2_residual.fill((e.lepton2_p4 + e.bjet2_p4 + neutrinos.second).M() - t_mass);
+                w1_residual.fill((e.lepton1_p4 + neutrinos.first).M() - w_mass);
+                w2_residual.fill((e.lepton2_p4 + neutrinos.second).M() - w_mass);
+
+                closest = std::min(closest, distance(neutrinos, e.neutrino1_p4, e.neutrino2_p4));
+            }
+            true_residual.fill(closest);
+        }
+
+        std::cout << std::endl << "Accuracy of getNeutrinos, " << title << " (GeV):" << std::endl;
+        top1_residual.print("m(l1 b1 nu1) - t_mass");
+        top2_residual.print("m(l2 b2 nu2) - t_mass");
+        w1_residual.print("m(l1 nu1) - w_mass");
+        w2_residual.print("m(l2 nu2) - w_mass");
+        true_residual.print("closest solution - generated nus");
+        std::cout << "  Events without any solution: " << n_no_solution << " / " << events.size() << std::endl;
+    }
+
+}
+
+int main(int argc, char** argv) {
+
+    const size_t n_events = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    const uint64_t seed = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 42;
+    const double t_mass = argc > 3 ? std::atof(argv[3]) : 172.5;
+    const double w_mass = argc > 4 ? std::atof(argv[4]) : 80.419002;
+
+    if (n_events == 0) {
+        std::cerr << "Usage: " << argv[0] << " [n_events] [seed] [top_mass] [w_mass]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Generating " << n_events << " dileptonic ttbar events (seed " << seed << ", mt = " << t_mass << ", mW = " << w_mass << ")" << std::endl;
+
+    EventGenerator generator(t_mass, w_mass, seed);
+    std::vector<Event> events;
+    events.reserve(n_events);
+    for (size_t i = 0; i < n_events; i++)
+        events.push_back(generator.generate());
+
+    NeutrinosSolver solver(t_mass, w_mass);
+    BasicNeutrinosSolver<float> float_solver(t_mass, w_mass);
+
+    // Prevents the compiler from optimizing the benchmarked calls away
+    size_t n_solutions = 0;
+
+    std::cout << std::endl << "Throughput:" << std::endl;
+
+    {
+        Timer timer;
+        n_solutions = 0;
+        for (const Event& e: events)
+            n_solutions += solver.getNeutrinos(e.lepton1_p4, e.lepton2_p4, e.bjet1_p4, e.bjet2_p4, e.met).size();
+        printThroughput("getNeutrinos (std::vector)", n_events, timer.seconds(), n_solutions);
+    }
+
+    {
+        std::array<NeutrinosSolver::NeutrinosPair, NeutrinosSolver::maxSolutions> neutrinos;
+        Timer timer;
+        n_solutions = 0;
+        for (const Event& e: events)
+            n_solutions += solver.getNeutrinos(e.lepton1_p4, e.lepton2_p4, e.bjet1_p4, e.bjet2_p4, e.met, neutrinos);
+        printThroughput("getNeutrinos (std::array)", n_events, timer.seconds(), n_solutions);
+    }
+
+    {
+        using FloatLorentzVector = BasicNeutrinosSolver<float>::LorentzVector;
+        std::vector<std::array<FloatLorentzVector, 5>> float_events;
+        float_events.reserve(n_events);
+        for (const Event& e: events)
+            float_events.push_back({{ FloatLorentzVector(e.lepton1_p4), FloatLorentzVector(e.lepton2_p4),
+                    FloatLorentzVector(e.bjet1_p4), FloatLorentzVector(e.bjet2_p4), FloatLorentzVector(e.met) }});
+
+        std::array<BasicNeutrinosSolver<float>::NeutrinosPair, NeutrinosSolver::maxSolutions> neutrinos;
+        Timer timer;
+        n_solutions = 0;
+        for (const auto& e: float_events)
+            n_solutions += float_solver.getNeutrinos(e[0], e[1], e[2], e[3], e[4], neutrinos);
+        printThroughput("getNeutrinos (std::array, float)", n_events, timer.seconds(), n_solutions);
+    }
+
+    {
+        NeutrinosSolver::P4Buffer lepton1_p4, lepton2_p4, bjet1_p4, bjet2_p4, met;
+        for (const Event& e: events) {
+            lepton1_p4.push_back(e.lepton1_p4);
+            lepton2_p4.push_back(e.lepton2_p4);
+            bjet1_p4.push_back(e.bjet1_p4);
+            bjet2_p4.push_back(e.bjet2_p4);
+            met.push_back(e.met);
+        }
+
+        NeutrinosSolver::P4Buffer neutrino1_p4, neutrino2_p4;
+        neutrino1_p4.resize(NeutrinosSolver::maxSolutions * n_events);
+        neutrino2_p4.resize(NeutrinosSolver::maxSolutions * n_events);
+        std::vector<uint8_t> n_solutions_batch(n_events);
+
+        Timer timer;
+        solver.getNeutrinos(n_events, lepton1_p4.view(), lepton2_p4.view(), bjet1_p4.view(), bjet2_p4.view(), met.view(),
+                neutrino1_p4.mutableView(), neutrino2_p4.mutableView(), n_solutions_batch.data());
+        const double seconds = timer.seconds();
+
+        n_solutions = 0;
+        for (uint8_t n: n_solutions_batch)
+            n_solutions += n;
+        printThroughput("getNeutrinos (batched)", n_events, seconds, n_solutions);
+    }
+
+    {
+        // Both assignments of the b-jets to the leptons, as done in the analysis: with the two-stage version,
+        // the coefficients of the 4 (lepton, b-jet) pairs are shared by the 2 sets of inputs
+        std::array<NeutrinosSolver::NeutrinosPair, NeutrinosSolver::maxSolutions> neutrinos;
+        Timer timer;
+        n_solutions = 0;
+        for (const Event& e: events) {
+            n_solutions += solver.getNeutrinos(e.lepton1_p4, e.lepton2_p4, e.bjet1_p4, e.bjet2_p4, e.met, neutrinos);
+            n_solutions += solver.getNeutrinos(e.lepton1_p4, e.lepton2_p4, e.bjet2_p4, e.bjet1_p4, e.met, neutrinos);
+        }
+        printThroughput("getNeutrinos (both assignments)", 2 * n_events, timer.seconds(), n_solutions);
+
+        std::array<NeutrinosSolver::PairCoefficients, 4> pairs;
+        timer = Timer();
+        n_solutions = 0;
+        for (const Event& e: events) {
+            solver.computePairCoefficients(e.lepton1_p4, e.bjet1_p4, pairs[0]);
+            solver.computePairCoefficients(e.lepton2_p4, e.bjet2_p4, pairs[1]);
+            solver.computePairCoefficients(e.lepton1_p4, e.bjet2_p4, pairs[2]);
+            solver.computePairCoefficients(e.lepton2_p4, e.bjet1_p4, pairs[3]);
+            n_solutions += solver.getNeutrinos(pairs[0], pairs[1], e.met, neutrinos);
+            n_solutions += solver.getNeutrinos(pairs[2], pairs[3], e.met, neutrinos);
+        }
+        printThroughput("getNeutrinos (pairs, both assignments)", 2 * n_events, timer.seconds(), n_solutions);
+    }
+
+    {
+        // Scan of 11 top mass hypotheses, 1 GeV apart around the generated mass: one call per set of inputs and per hypothesis
+        const size_t n_masses = 11;
+        std::vector<NeutrinosSolver::Masses> masses;
+        std::vector<std::unique_ptr<NeutrinosSolver>> solvers;
+        for (size_t k = 0; k < n_masses; k++) {
+            const float top_mass = t_mass + (float(k) - (n_masses - 1) / 2);
+            masses.push_back({ top_mass, float(w_mass) });
+            solvers.emplace_back(new NeutrinosSolver(top_mass, w_mass));
+        }
+
+        NeutrinosSolver::MassIndependentCoefficients coefficients;
+        NeutrinosSolver::P4Buffer neutrino1_p4, neutrino2_p4;
+        neutrino1_p4.resize(NeutrinosSolver::maxSolutions * n_masses);
+        neutrino2_p4.resize(NeutrinosSolver::maxSolutions * n_masses);
+        std::vector<uint8_t> n_solutions_scan(n_masses);
+
+        Timer timer;
+        n_solutions = 0;
+        for (const Event& e: events) {
+            solver.computeMassIndependentCoefficients(e.lepton1_p4, e.lepton2_p4, e.bjet1_p4, e.bjet2_p4, e.met, coefficients);
+            solver.getNeutrinos(coefficients, n_masses, masses.data(), neutrino1_p4.mutableView(), neutrino2_p4.mutableView(), n_solutions_scan.data());
+            for (uint8_t n: n_solutions_scan)
+                n_solutions += n;
+        }
+        printThroughput("getNeutrinos (mass scan, 11 points)", n_masses * n_events, timer.seconds(), n_solutions);
+
+        std::array<NeutrinosSolver::NeutrinosPair, NeutrinosSolver::maxSolutions> neutrinos;
+        timer = Timer();
+        n_solutions = 0;
+        for (const Event& e: events) {
+            for (const auto& s: solvers)
+                n_solutions += s->getNeutrinos(e.lepton1_p4, e.lepton2_p4, e.bjet1_p4, e.bjet2_p4, e.met, neutrinos);
+        }
+        printThroughput("getNeutrinos (11 solvers)", n_masses * n_events, timer.seconds(), n_solutions);
+    }
+
+    {
+        std::vector<NeutrinosSolver::Coefficients> coefficients(n_events);
+        for (size_t i = 0; i < n_events; i++) {
+            const Event& e = events[i];
+            solver.computeCoefficients(e.lepton1_p4, e.lepton2_p4, e.bjet1_p4, e.bjet2_p4, e.met, coefficients[i]);
+        }
+
+        Timer timer;
+        n_solutions = 0;
+        for (const NeutrinosSolver::Coefficients& c: coefficients) {
+            Roots E1, E2;
+            solve2Quads(c.a11, c.a22, c.a12, c.a10, c.a01, c.a00, c.b11, c.b22, c.b12, c.b10, c.b01, c.b00, E1, E2);
+            n_solutions += E1.size();
+        }
+        printThroughput("solve2Quads", n_events, timer.seconds(), n_solutions);
+    }
+
+    // Quartics with 4 known real roots in the range of the neutrino energies, used for both throughput and accuracy
+    std::vector<std::array<double, 4>> quartic_roots(n_events);
+    {
+        std::mt19937_64 rng(seed);
+        std::uniform_real_distribution<double> energy(0., 500.);
+        for (auto& roots: quartic_roots) {
+            for (double& root: roots)
+                root = energy(rng);
+            std::sort(roots.begin(), roots.end());
+        }
+    }
+
+    // Coefficients of (x - r0)(x - r1)(x - r2)(x - r3), leading coefficient 1
+    auto quartic = [](const std::array<double, 4>& r, double* c) {
+        c[0] = 1.;
+        c[1] = -(r[0] + r[1] + r[2] + r[3]);
+        c[2] = r[0]*r[1] + r[0]*r[2] + r[0]*r[3] + r[1]*r[2] + r[1]*r[3] + r[2]*r[3];
+        c[3] = -(r[0]*r[1]*r[2] + r[0]*r[1]*r[3] + r[0]*r[2]*r[3] + r[1]*r[2]*r[3]);
+        c[4] = r[0]*r[1]*r[2]*r[3];
+    };
+
+    Residual quartic_residual;
+    {
+        std::vector<std::array<double, 5>> coefficients(n_events);
+        for (size_t i = 0; i < n_events; i++)
+            quartic(quartic_roots[i], coefficients[i].data());
+
+        std::vector<Roots> roots(n_events);
+
+        Timer timer;
+        n_solutions = 0;
+        for (size_t i = 0; i < n_events; i++) {
+            const auto& c = coefficients[i];
+            solveQuartic(c[0], c[1], c[2], c[3], c[4], roots[i]);
+            n_solutions += roots[i].size();
+        }
+        printThroughput("solveQuartic", n_events, timer.seconds(), n_solutions);
+
+        for (size_t i = 0; i < n_events; i++) {
+            for (double root: roots[i]) {
+                double closest = std::numeric_limits<double>::max();
+                for (double expected: quartic_roots[i]) {
+                    if (std::abs(root - expected) < std::abs(closest))
+                        closest = root - expected;
+                }
+                quartic_residual.fill(closest);
+            }
+        }
+    }
+
+    std::cout << std::endl << "Accuracy of solveQuartic:" << std::endl;
+    quartic_residual.print("solveQuartic root - exact root");
+
+    printAccuracy("double precision", solver, events, t_mass, w_mass);
+    printAccuracy("single precision", float_solver, events, t_mass, w_mass);
+
+    return 0;
+}
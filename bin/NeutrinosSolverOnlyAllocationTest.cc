@@ -0,0 +1,234 @@
+// Standalone check that the calls to NeutrinosSolver made by the ttbar reconstruction do not allocate in steady state.
+//
+// Only the solver is covered: this does not run TTAnalyzer::analyze() nor any of its stages, the index lists or the
+// categories, which need a cmsRun job. A sample of dileptonic ttbar events, with a varying number of additional jets, is
+// replayed through the solver calls of the ttbar reconstruction, on caller-owned buffers laid out like TTAnalyzer::MttScratch:
+// coefficients shared by the (lepton, b-jet) pairs, batched solve of both assignments of all the candidates, smeared
+// variations of the inputs without solution, and solutions collected per candidate. The sample is processed once to size
+// the buffers, then replayed: once their capacity fits the busiest event of the sample, no heap allocation may happen.
+// Exits with a non-zero status if any does.
+//
+// Usage: ttNeutrinosSolverOnlyAllocationTest [n_events=1000] [seed=42] [smearing_samples=20]
+
+#include <cp3_llbb/TTAnalysis/interface/NeutrinosSolver.h>
+
+#include "DileptonTTbarGenerator.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <vector>
+
+using LorentzVector = NeutrinosSolver::LorentzVector;
+
+namespace {
+
+    // Heap allocations made through operator new while counting is enabled
+    bool g_counting = false;
+    uint64_t g_allocations = 0;
+
+    void* allocate(size_t size) {
+        if (g_counting)
+            g_allocations++;
+
+        void* p = std::malloc(size ? size : 1);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    struct ReplayedEvent {
+        LorentzVector lepton1_p4, lepton2_p4;
+        LorentzVector met;
+        // The two b-jets first, then the additional jets
+        std::vector<LorentzVector> jets;
+    };
+
+    // Same layout as the scratch storage of the ttbar reconstruction, kept across events (see TTAnalyzer::MttScratch)
+    struct Scratch {
+        std::vector<int32_t> pair_slot;
+        std::vector<NeutrinosSolver::PairCoefficients> pairs;
+        std::vector<uint32_t> pairs1, pairs2;
+        NeutrinosSolver::P4Buffer met_p4, neutrino1_p4, neutrino2_p4;
+        std::vector<uint8_t> n_solutions;
+        std::vector<std::vector<NeutrinosSolver::NeutrinosPair>> solutions;
+        NeutrinosSolver::Samples samples;
+    };
+
+    // Build the candidates of one event out of each pair of jets, solve for both assignments of the b-jets to the leptons,
+    // and collect the top quarks of the solutions of each candidate. Returns the number of solutions.
+    size_t reconstruct(NeutrinosSolver& solver, const ReplayedEvent& event, const uint64_t seed, const size_t n_samples, Scratch& scratch) {
+
+        const LorentzVector leptons[2] = { event.lepton1_p4, event.lepton2_p4 };
+        const size_t n_jets = event.jets.size();
+
+        scratch.pair_slot.assign(2 * n_jets, -1);
+        scratch.pairs.clear();
+        scratch.pairs1.clear();
+        scratch.pairs2.clear();
+        scratch.met_p4.clear();
+
+        auto pair = [&](const size_t lepton, const size_t jet) -> uint32_t {
+            int32_t& slot = scratch.pair_slot[lepton * n_jets + jet];
+            if (slot < 0) {
+                slot = scratch.pairs.size();
+                scratch.pairs.emplace_back();
+                solver.computePairCoefficients(leptons[lepton], event.jets[jet], scratch.pairs.back());
+            }
+            return slot;
+        };
+
+        for (size_t jet1 = 0; jet1 < n_jets; jet1++) {
+            for (size_t jet2 = jet1 + 1; jet2 < n_jets; jet2++) {
+                for (uint8_t swap = 0; swap < 2; swap++) {
+                    scratch.pairs1.push_back(pair(0, swap ? jet2 : jet1));
+                    scratch.pairs2.push_back(pair(1, swap ? jet1 : jet2));
+                    scratch.met_p4.push_back(event.met);
+                }
+            }
+        }
+
+        const size_t n_inputs = scratch.pairs1.size();
+        const size_t n_candidates = n_inputs / 2;
+
+        scratch.neutrino1_p4.resize(NeutrinosSolver::maxSolutions * n_inputs);
+        scratch.neutrino2_p4.resize(NeutrinosSolver::maxSolutions * n_inputs);
+        scratch.n_solutions.resize(n_inputs);
+
+        if (scratch.solutions.size() < n_candidates)
+            scratch.solutions.resize(n_candidates);
+        for (size_t candidate = 0; candidate < n_candidates; candidate++)
+            scratch.solutions[candidate].clear();
+
+        solver.getNeutrinos(n_inputs, scratch.pairs.data(), scratch.pairs1.data(), scratch.pairs2.data(), scratch.met_p4.view(),
+                scratch.neutrino1_p4.mutableView(), scratch.neutrino2_p4.mutableView(), scratch.n_solutions.data());
+
+        const NeutrinosSolver::Resolutions resolutions = { 0.1, 20. };
+        size_t n_solutions = 0;
+
+        for (size_t input = 0; input < n_inputs; input++) {
+            std::vector<NeutrinosSolver::NeutrinosPair>& tops = scratch.solutions[input / 2];
+
+            const NeutrinosSolver::PairCoefficients& pair1 = scratch.pairs[scratch.pairs1[input]];
+            const NeutrinosSolver::PairCoefficients& pair2 = scratch.pairs[scratch.pairs2[input]];
+
+            for (uint8_t sol = 0; sol < scratch.n_solutions[input]; sol++) {
+                const size_t sol_idx = NeutrinosSolver::maxSolutions * input + sol;
+                tops.emplace_back(pair1.lepton_p4() + pair1.bjet_p4() + scratch.neutrino1_p4.at(sol_idx),
+                        pair2.lepton_p4() + pair2.bjet_p4() + scratch.neutrino2_p4.at(sol_idx));
+            }
+
+            if (scratch.n_solutions[input] == 0 && n_samples > 0) {
+                solver.getSmearedNeutrinos(pair1.lepton_p4(), pair2.lepton_p4(), pair1.bjet_p4(), pair2.bjet_p4(), scratch.met_p4.at(input),
+                        n_samples, resolutions, seed + input, scratch.samples);
+
+                for (size_t sample = 0; sample < scratch.samples.size(); sample++) {
+                    if (scratch.samples.n_solutions[sample] == 0)
+                        continue;
+
+                    const size_t sol_idx = NeutrinosSolver::maxSolutions * sample;
+                    tops.emplace_back(pair1.lepton_p4() + scratch.samples.bjet1_p4.at(sample) + scratch.samples.neutrino1_p4.at(sol_idx),
+                            pair2.lepton_p4() + scratch.samples.bjet2_p4.at(sample) + scratch.samples.neutrino2_p4.at(sol_idx));
+                }
+            }
+
+            n_solutions += tops.size();
+        }
+
+        return n_solutions;
+    }
+
+}
+
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+int main(int argc, char** argv) {
+
+    const size_t n_events = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    const uint64_t seed = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 42;
+    const size_t n_samples = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 20;
+
+    if (n_events == 0) {
+        std::cerr << "Usage: " << argv[0] << " [n_events] [seed] [smearing_samples]" << std::endl;
+        return 1;
+    }
+
+    const double t_mass = 172.5;
+    const double w_mass = 80.419002;
+
+    // Events with 0 to 4 additional jets, so that the number of candidates changes from one event to the next
+    DileptonTTbar::EventGenerator generator(t_mass, w_mass, seed);
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<size_t> n_extra_jets(0, 4);
+    std::exponential_distribution<double> extra_jet_pt(1. / 40.);
+    std::normal_distribution<double> extra_jet_eta(0., 1.5);
+    std::uniform_real_distribution<double> extra_jet_phi(-M_PI, M_PI);
+
+    std::vector<ReplayedEvent> events(n_events);
+    for (ReplayedEvent& event: events) {
+        const DileptonTTbar::Event e = generator.generate();
+        event.lepton1_p4 = e.lepton1_p4;
+        event.lepton2_p4 = e.lepton2_p4;
+        event.met = e.met;
+        event.jets = { e.bjet1_p4, e.bjet2_p4 };
+
+        for (size_t n = n_extra_jets(rng); n > 0; n--) {
+            const double pt = 30. + extra_jet_pt(rng);
+            const double eta = extra_jet_eta(rng);
+            const double phi = extra_jet_phi(rng);
+            const double pz = pt * std::sinh(eta);
+            event.jets.push_back(LorentzVector(pt * std::cos(phi), pt * std::sin(phi), pz, std::sqrt(SQ(pt) + SQ(pz) + SQ(DileptonTTbar::b_mass))));
+        }
+    }
+
+    // Configured as in the analyzer
+    NeutrinosSolver solver(t_mass, w_mass);
+    NeutrinosSolver::PreFilter preFilter;
+    preFilter.enabled = true;
+    solver.setPreFilter(preFilter);
+    solver.setTiming(true);
+
+    Scratch scratch;
+
+    size_t n_solutions_warmup = 0;
+    for (size_t i = 0; i < n_events; i++)
+        n_solutions_warmup += reconstruct(solver, events[i], seed + i, n_samples, scratch);
+
+    size_t n_solutions_replay = 0;
+    g_counting = true;
+    for (size_t i = 0; i < n_events; i++)
+        n_solutions_replay += reconstruct(solver, events[i], seed + i, n_samples, scratch);
+    g_counting = false;
+
+    std::cout << "Replayed " << n_events << " events (" << n_solutions_replay << " ttbar solutions, " << n_samples << " smearing samples): "
+        << g_allocations << " heap allocations after warm-up" << std::endl;
+
+    if (n_solutions_replay != n_solutions_warmup) {
+        std::cerr << "FAILED: the replay found " << n_solutions_replay << " solutions instead of " << n_solutions_warmup << std::endl;
+        return 1;
+    }
+
+    if (g_allocations > 0) {
+        std::cerr << "FAILED: the neutrinos solver allocates in steady state" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
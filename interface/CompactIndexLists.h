@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Compact form of the std::vector<std::vector<uint16_t>> index branches, written by TTAnalyzer if `compactIndexBranches` is set.
+// Branch NAME is replaced by NAME_offsets and by NAME_indices (or NAME_deltas if `deltaEncodeIndexBranches` is set):
+// list i is made of entries offsets[i] to offsets[i + 1] (excluded) of the flat index array, and offsets has one more
+// entry than the number of lists. With delta encoding, each index is stored as its difference (modulo 2^16) with the
+// previous index of the same list, the first one as is.
+//
+// Only depends on the standard library, to be usable from plain ROOT macros.
+
+namespace TTAnalysis {
+
+  inline void encodeIndexLists(const std::vector<std::vector<uint16_t>>& lists, const bool deltas, std::vector<uint16_t>& indices, std::vector<uint32_t>& offsets) {
+    indices.clear();
+    offsets.resize(lists.size() + 1);
+
+    offsets[0] = 0;
+    for(size_t list = 0; list < lists.size(); list++){
+      uint16_t previous = 0;
+      for(const uint16_t& index: lists[list]){
+        indices.push_back(deltas ? uint16_t(index - previous) : index);
+        previous = index;
+      }
+      offsets[list + 1] = indices.size();
+    }
+  }
+
+  // Per-list view of a compact index branch, e.g. reading NAME_indices (or NAME_deltas) and NAME_offsets:
+  //   TTAnalysis::CompactIndexLists lists(*indices, *offsets, false);
+  //   for (uint16_t jet: lists[combination]) ...
+  // The arrays are referenced, not copied: the view follows them from one entry of the tree to the next.
+  class CompactIndexLists {
+
+    public:
+
+      CompactIndexLists(const std::vector<uint16_t>& indices, const std::vector<uint32_t>& offsets, const bool deltas):
+        m_indices(indices), m_offsets(offsets), m_deltas(deltas) {}
+
+      size_t size() const { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+      size_t size(const size_t list) const { return m_offsets[list + 1] - m_offsets[list]; }
+
+      // Decode list `list` into `indices`, reusing its capacity
+      void get(const size_t list, std::vector<uint16_t>& indices) const {
+        indices.clear();
+        uint16_t previous = 0;
+        for(uint32_t entry = m_offsets[list]; entry < m_offsets[list + 1]; entry++){
+          previous = m_deltas ? uint16_t(previous + m_indices[entry]) : m_indices[entry];
+          indices.push_back(previous);
+        }
+      }
+
+      std::vector<uint16_t> operator[](const size_t list) const {
+        std::vector<uint16_t> indices;
+        get(list, indices);
+        return indices;
+      }
+
+      // Rebuild the std::vector<std::vector<uint16_t>> written without compact encoding
+      void get(std::vector<std::vector<uint16_t>>& lists) const {
+        lists.resize(size());
+        for(size_t list = 0; list < lists.size(); list++)
+          get(list, lists[list]);
+      }
+
+    private:
+
+      const std::vector<uint16_t>& m_indices;
+      const std::vector<uint32_t>& m_offsets;
+      const bool m_deltas;
+  };
+
+}
@@ -3,6 +3,9 @@
 #include <map>
 #include <array>
 #include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
 
 namespace TTAnalysis {
   
@@ -22,21 +25,57 @@ namespace TTAnalysis {
     const std::map<LepIso, std::string> map = { {L, "L"}, {T, "T"} };
   }
 
+  // The combination indices below are computed at compile time when the working points are known, and each has an inverse
+  // (from the index back to the working points). The names are computed once per job into static tables: the returned
+  // references stay valid until the end of the job.
+
   // Combination of Lepton ID + Lepton Isolation for a single lepton
-  uint16_t LepIDIso(const LepID::LepID& id, const LepIso::LepIso& iso);
-  std::string LepIDIsoStr(const LepID::LepID& id, const LepIso::LepIso& iso);
+  constexpr uint16_t LepIDIso(const LepID::LepID& id, const LepIso::LepIso& iso){
+    return LepIso::Count * id + iso;
+  }
+  constexpr LepID::LepID LepIDIsoID(const uint16_t idx){
+    return LepID::LepID(idx / LepIso::Count);
+  }
+  constexpr LepIso::LepIso LepIDIsoIso(const uint16_t idx){
+    return LepIso::LepIso(idx % LepIso::Count);
+  }
+  const std::string& LepIDIsoStr(const LepID::LepID& id, const LepIso::LepIso& iso);
 
   // Combination of Lepton ID for a DiLepton object
-  uint16_t LepLepID(const LepID::LepID& id1, const LepID::LepID& id2);
-  std::string LepLepIDStr(const LepID::LepID& id1, const LepID::LepID& id2);
+  constexpr uint16_t LepLepID(const LepID::LepID& id1, const LepID::LepID& id2){
+    return LepID::Count * id1 + id2;
+  }
+  const std::string& LepLepIDStr(const LepID::LepID& id1, const LepID::LepID& id2);
 
   // Combination of Lepton Isolation for a DiLepton object
-  uint16_t LepLepIso(const LepIso::LepIso& iso1, const LepIso::LepIso& iso2);
-  std::string LepLepIsoStr(const LepIso::LepIso& iso1, const LepIso::LepIso& iso2);
+  constexpr uint16_t LepLepIso(const LepIso::LepIso& iso1, const LepIso::LepIso& iso2){
+    return LepIso::Count * iso1 + iso2;
+  }
+  const std::string& LepLepIsoStr(const LepIso::LepIso& iso1, const LepIso::LepIso& iso2);
 
   // Combination of Lepton ID + Lepton Isolation for a DiLepton object
-  uint16_t LepLepIDIso(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2);
-  std::string LepLepIDIsoStr(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2);
+  constexpr uint16_t LepLepIDIso(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2){
+    return LepIso::Count*LepID::Count*LepIso::Count * id1 + LepID::Count*LepIso::Count * iso1 + LepIso::Count * id2 + iso2;
+  }
+  constexpr LepID::LepID LepLepIDIsoID1(const uint16_t idx){
+    return LepID::LepID(idx / (LepIso::Count*LepID::Count*LepIso::Count));
+  }
+  constexpr LepIso::LepIso LepLepIDIsoIso1(const uint16_t idx){
+    return LepIso::LepIso(idx / (LepID::Count*LepIso::Count) % LepIso::Count);
+  }
+  constexpr LepID::LepID LepLepIDIsoID2(const uint16_t idx){
+    return LepID::LepID(idx / LepIso::Count % LepID::Count);
+  }
+  constexpr LepIso::LepIso LepLepIDIsoIso2(const uint16_t idx){
+    return LepIso::LepIso(idx % LepIso::Count);
+  }
+  // Loosest ID + loosest isolation of the two leptons, as a single lepton combination (used to clean the jets)
+  constexpr uint16_t LepLepIDIsoLoosest(const uint16_t idx){
+    return LepIDIso(
+        LepLepIDIsoID1(idx) < LepLepIDIsoID2(idx) ? LepLepIDIsoID1(idx) : LepLepIDIsoID2(idx),
+        LepLepIDIsoIso1(idx) < LepLepIDIsoIso2(idx) ? LepLepIDIsoIso1(idx) : LepLepIDIsoIso2(idx));
+  }
+  const std::string& LepLepIDIsoStr(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2);
 
   // Jet ID
   namespace JetID {
@@ -46,8 +85,10 @@ namespace TTAnalysis {
   }
 
   // Combination of Jet IDs for two jets (NOTE: NOT USED FOR NOW)
-  uint16_t JetJetID(const JetID::JetID& id1, const JetID::JetID& id2);
-  std::string JetJetIDStr(const JetID::JetID& id1, const JetID::JetID& id2);
+  constexpr uint16_t JetJetID(const JetID::JetID& id1, const JetID::JetID& id2){
+    return JetID::Count * id1 + id2;
+  }
+  const std::string& JetJetIDStr(const JetID::JetID& id1, const JetID::JetID& id2);
   
   // B-tagging working points
   namespace BWP {
@@ -57,28 +98,103 @@ namespace TTAnalysis {
   }
 
   // Combination of Jet ID and B-tagging working point (NOTE: NOT USED FOR NOW)
-  uint16_t JetIDBWP(const JetID::JetID& id, const BWP::BWP& wp);
-  std::string JetIDBWPStr(const JetID::JetID& id, const BWP::BWP& wp);
+  constexpr uint16_t JetIDBWP(const JetID::JetID& id, const BWP::BWP& wp){
+    return BWP::Count * id + wp;
+  }
+  const std::string& JetIDBWPStr(const JetID::JetID& id, const BWP::BWP& wp);
   
   // Combination of Lepton ID + Lepton Isolation (one lepton) and B-tagging working point for one jet
-  uint16_t LepIDIsoJetBWP(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp);
-  std::string LepIDIsoJetBWPStr(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp);
+  constexpr uint16_t LepIDIsoJetBWP(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp){
+    return LepIso::Count*BWP::Count * id + BWP::Count * iso + wp;
+  }
+  const std::string& LepIDIsoJetBWPStr(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp);
 
   // Combination of B-tagging working points for two jets
-  uint16_t JetJetBWP(const BWP::BWP& wp1, const BWP::BWP& wp2);
-  std::string JetJetBWPStr(const BWP::BWP& wp1, const BWP::BWP& wp2);
+  constexpr uint16_t JetJetBWP(const BWP::BWP& wp1, const BWP::BWP& wp2){
+    return BWP::Count * wp1 + wp2;
+  }
+  constexpr BWP::BWP JetJetBWP1(const uint16_t idx){
+    return BWP::BWP(idx / BWP::Count);
+  }
+  constexpr BWP::BWP JetJetBWP2(const uint16_t idx){
+    return BWP::BWP(idx % BWP::Count);
+  }
+  const std::string& JetJetBWPStr(const BWP::BWP& wp1, const BWP::BWP& wp2);
 
   // Combination of Jet ID and B-tagging working points for two jets (NOTE: NOT USED FOR NOW)
-  uint16_t JetJetIDBWP(const JetID::JetID& id1, const BWP::BWP& wp1, const JetID::JetID& id2, const BWP::BWP& wp2);
-  std::string JetJetIDBWPStr(const JetID::JetID& id1, const BWP::BWP wp1, const JetID::JetID& id2, const BWP::BWP wp2);
+  constexpr uint16_t JetJetIDBWP(const JetID::JetID& id1, const BWP::BWP& wp1, const JetID::JetID& id2, const BWP::BWP& wp2){
+    return 
+      BWP::Count*JetID::Count*BWP::Count * id1 + 
+                 JetID::Count*BWP::Count * wp1 + 
+                              BWP::Count * id2 + 
+                                           wp2 ;
+  }
+  const std::string& JetJetIDBWPStr(const JetID::JetID& id1, const BWP::BWP wp1, const JetID::JetID& id2, const BWP::BWP wp2);
   
   // Combination of Lepton ID + Lepton Isolation (one lepton) and B-tagging working points for two jets
-  uint16_t LepIDIsoJetJetBWP(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp1, const BWP::BWP& wp2);
-  std::string LepIDIsoJetJetBWPStr(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp1, const BWP::BWP& wp2);
+  constexpr uint16_t LepIDIsoJetJetBWP(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp1, const BWP::BWP& wp2){
+    return LepIso::Count*BWP::Count*BWP::Count * id + BWP::Count*BWP::Count * iso + BWP::Count * wp1 + wp2;
+  }
+  const std::string& LepIDIsoJetJetBWPStr(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp1, const BWP::BWP& wp2);
   
   // Combination of Lepton ID, Lepton Isolation, and B-tagging working points for a two-lepton-two-b-jets object
-  uint16_t LepLepIDIsoJetJetBWP(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2, const BWP::BWP& wp1, const BWP::BWP& wp2);
-  std::string LepLepIDIsoJetJetBWPStr(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2, const BWP::BWP& wp1, const BWP::BWP& wp2);
+  constexpr uint16_t LepLepIDIsoJetJetBWP(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2, const BWP::BWP& wp1, const BWP::BWP& wp2){
+    return 
+      LepIso::Count*LepID::Count*LepIso::Count*BWP::Count*BWP::Count * id1  + 
+                    LepID::Count*LepIso::Count*BWP::Count*BWP::Count * iso1 + 
+                                 LepIso::Count*BWP::Count*BWP::Count * id2  + 
+                                               BWP::Count*BWP::Count * iso2 + 
+                                                          BWP::Count * wp1  + 
+                                                                       wp2  ;
+  }
+  // Lepton part (as a LepLepIDIso index) and b-tagging part (as a JetJetBWP index) of a combination
+  constexpr uint16_t LepLepIDIsoJetJetBWPLepLepIDIso(const uint16_t idx){
+    return idx / (BWP::Count*BWP::Count);
+  }
+  constexpr uint16_t LepLepIDIsoJetJetBWPJetJetBWP(const uint16_t idx){
+    return idx % (BWP::Count*BWP::Count);
+  }
+  const std::string& LepLepIDIsoJetJetBWPStr(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2, const BWP::BWP& wp1, const BWP::BWP& wp2);
+  const std::string& LepLepIDIsoJetJetBWPStr(const uint16_t idx);
+
+  // Subset of the combinations of working points for two-lepton-two-b-jets objects (given by their LepLepIDIsoJetJetBWPStr names,
+  // all of them if the list is empty), and the lower-level combinations needed to build them.
+  // Both lists are in the order of the nested loops over all the working points (ID1, ID2, Iso1, Iso2, B1, B2).
+  class WorkingPoints {
+    public:
+      // Lepton ID + isolation for a single lepton. If `loosest` is set, this is the loosest ID + isolation of the leptons of
+      // a selected combination: the jets are then cleaned with respect to these leptons, and the b-tagging working points
+      // used for single jets (resp. pairs of jets) are listed in `bwps` (resp. `bwpPairs`).
+      struct Lepton {
+        LepID::LepID id;
+        LepIso::LepIso iso;
+        bool loosest;
+        std::vector<BWP::BWP> bwps;
+        std::vector<std::pair<BWP::BWP, BWP::BWP>> bwpPairs;
+      };
+
+      // Lepton ID + isolation for a DiLepton object, and the selected b-tagging working points for the two b-jets
+      struct DiLepton {
+        LepID::LepID id1;
+        LepIso::LepIso iso1;
+        LepID::LepID id2;
+        LepIso::LepIso iso2;
+        std::vector<std::pair<BWP::BWP, BWP::BWP>> bwpPairs;
+      };
+
+      // Throws if one of the names is not the name of a combination
+      explicit WorkingPoints(const std::vector<std::string>& names);
+
+      const std::vector<Lepton>& leptons() const { return m_leptons; }
+      const std::vector<DiLepton>& diLeptons() const { return m_diLeptons; }
+
+      // Names of the selected combinations
+      std::vector<std::string> names() const;
+
+    private:
+      std::vector<Lepton> m_leptons;
+      std::vector<DiLepton> m_diLeptons;
+  };
 
 
   enum TTDecayType {
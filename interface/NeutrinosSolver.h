@@ -1,7 +1,10 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <utility>
+#include <cstddef>
+#include <cstdint>
 
 #include <Math/Vector4D.h>
 
@@ -9,10 +12,70 @@
 #define CB(x) (x*x*x)
 #define QU(x) (x*x*x*x)
 
-inline double cosXpm2PI3(const double x, const double pm){
-    return -0.5 * (std::cos(x) + pm * std::sin(x) * std::sqrt(3.));
+template<typename T>
+inline T cosXpm2PI3(const T x, const T pm){
+    return T(-0.5) * (std::cos(x) + pm * std::sin(x) * std::sqrt(T(3.)));
 }
 
+// Fixed-capacity, stack-only storage for the roots found by the functions below.
+// None of them produces more than 4 roots, so no heap allocation is ever needed.
+template<typename T>
+class BasicRoots {
+    public:
+        static const size_t capacity = 4;
+
+        BasicRoots(): m_size(0) {}
+
+        void push_back(const T root) {
+            if (m_size < capacity)
+                m_roots[m_size++] = root;
+        }
+        // Only used to drop roots: n must not exceed size()
+        void resize(const size_t n) { m_size = n; }
+        void clear() { m_size = 0; }
+
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+
+        T& operator[](const size_t i) { return m_roots[i]; }
+        T operator[](const size_t i) const { return m_roots[i]; }
+
+        const T* begin() const { return m_roots; }
+        const T* end() const { return m_roots + m_size; }
+
+    private:
+        T m_roots[capacity];
+        size_t m_size;
+};
+
+template<typename T> const size_t BasicRoots<T>::capacity;
+
+using Roots = BasicRoots<double>;
+
+// Number of times the degenerate branches of solve2Quads are taken
+struct ConicsBranchCounters {
+    uint64_t quads_deg = 0; // No E1^2 nor E2^2 term: solve2QuadsDeg
+    uint64_t linear = 0; // No quadratic term at all: solve2Linear
+    uint64_t zero_denominator = 0; // beta*e2 + gamma == 0 when computing e1 from a root e2 of the quartic
+
+    ConicsBranchCounters& operator+=(const ConicsBranchCounters& other) {
+        quads_deg += other.quads_deg;
+        linear += other.linear;
+        zero_denominator += other.zero_denominator;
+        return *this;
+    }
+};
+
+// The solvers below are templated on the scalar type, and instantiated for float and double
+template<typename T> bool solveQuadratic(const T a, const T b, const T c, BasicRoots<T>& roots);
+template<typename T> bool solveCubic(const T a, const T b, const T c, const T d, BasicRoots<T>& roots);
+template<typename T> bool solveQuartic(const T a, const T b, const T c, const T d, const T e, BasicRoots<T>& roots);
+// If `counters` is given, it is incremented each time a degenerate branch is taken
+template<typename T> bool solve2Quads(const T a20, const T a02, const T a11, const T a10, const T a01, const T a00, const T b20, const T b02, const T b11, const T b10, const T b01, const T b00, BasicRoots<T>& E1, BasicRoots<T>& E2, ConicsBranchCounters* counters = nullptr);
+template<typename T> bool solve2QuadsDeg(const T a11, const T a10, const T a01, const T a00, const T b11, const T b10, const T b01, const T b00, BasicRoots<T>& E1, BasicRoots<T>& E2);
+template<typename T> bool solve2Linear(const T a10, const T a01, const T a00, const T b10, const T b01, const T b00, BasicRoots<T>& E1, BasicRoots<T>& E2);
+
+// Same as above, appending the roots to a std::vector
 bool solveQuadratic(const double a, const double b, const double c, std::vector<double>& roots);
 bool solveCubic(const double a, const double b, const double c, const double d, std::vector<double>& roots);
 bool solveQuartic(const double a, const double b, const double c, const double d, const double e, std::vector<double>& roots);
@@ -20,22 +83,302 @@ bool solve2Quads(const double a20, const double a02, const double a11, const dou
 bool solve2QuadsDeg(const double a11, const double a10, const double a01, const double a00, const double b11, const double b10, const double b01, const double b00, std::vector<double>& E1, std::vector<double>& E2);
 bool solve2Linear(const double a10, const double a01, const double a00, const double b10, const double b01, const double b00, std::vector<double>& E1, std::vector<double>& E2);
 
-class NeutrinosSolver {
+// Intermediate terms of the coefficients of the neutrinos solver depending on only one (lepton, b-jet) pair:
+// scalar products lb = l.b, ll = l.l, bb = b.b, A = 2(-lx + lz bx/bz), B = 2(-ly + lz by/bz), r = lz/bz, e = lE - bE lz/bz
+template<typename T>
+struct NeutrinosSolverPairTerms {
+    T lx, ly, lz, lE;
+    T bx, by, bz, bE;
+    T lb, ll, bb;
+    T A, B, r, e;
+};
+
+// Intermediate terms of the coefficients of the neutrinos solver which do not depend on the top and W masses.
+// p3 = lepton 1, p4 = b-jet 1, p5 = lepton 2, p6 = b-jet 2, pT = transverse momentum of the visible particles and ISR,
+// pij = pi.pj, r4 = p3z/p4z, r6 = p5z/p6z, pT5 = pT.p5, pT6x = pTx p6x, pT6y = pTy p6y
+template<typename T>
+struct NeutrinosSolverMassIndependentTerms {
+    T pTx, pTy;
+    T p4x, p4y, p4z;
+    T p6x, p6y, p6z;
+    T p33, p34, p44, p55, p56, p66;
+    T A1, A2, B1, B2, Dx, Dy;
+    T r4, r6, pT5, pT6x, pT6y;
+};
+
+// Neutrinos solver, templated on the scalar type used for the inputs, the outputs and the computations.
+// Instantiated for float and double; use the NeutrinosSolver alias for the double version.
+template<typename T>
+class BasicNeutrinosSolver {
     public:
-        using LorentzVector = ROOT::Math::LorentzVector<ROOT::Math::PxPyPzE4D<double>>;
+        using Scalar = T;
+        using LorentzVector = ROOT::Math::LorentzVector<ROOT::Math::PxPyPzE4D<T>>;
+
+        using NeutrinosPair = std::pair<LorentzVector, LorentzVector>;
+
+        // Maximal number of solutions for one set of inputs (intersection of two conics)
+        static const size_t maxSolutions = 4;
+
+        // Structure-of-arrays view over the four-momenta of a set of objects
+        template<typename U> struct P4ArrayView {
+            U* px;
+            U* py;
+            U* pz;
+            U* E;
+        };
+        using ConstP4Array = P4ArrayView<const T>;
+        using P4Array = P4ArrayView<T>;
+
+        // Owning structure-of-arrays storage, to build the inputs and hold the outputs of the batched solver
+        struct P4Buffer {
+            std::vector<T> px, py, pz, E;
+
+            size_t size() const { return E.size(); }
+            void clear() { px.clear(); py.clear(); pz.clear(); E.clear(); }
+            void resize(size_t n) { px.resize(n); py.resize(n); pz.resize(n); E.resize(n); }
+            void push_back(const LorentzVector& p4) {
+                px.push_back(p4.Px());
+                py.push_back(p4.Py());
+                pz.push_back(p4.Pz());
+                E.push_back(p4.E());
+            }
+            LorentzVector at(size_t i) const { return LorentzVector(px[i], py[i], pz[i], E[i]); }
+            ConstP4Array view() const { return { px.data(), py.data(), pz.data(), E.data() }; }
+            P4Array mutableView() { return { px.data(), py.data(), pz.data(), E.data() }; }
+        };
+
+        // Coefficients of the two conics in (E1, E2) whose intersections give the neutrino energies,
+        // and of the linear relations giving the neutrino momenta as functions of (E1, E2):
+        //   p1x = alpha1 E1 + beta1 E2 + gamma1, p1y = ...(2), p1z = ...(3)
+        //   p2x = ...(5), p2y = ...(6), p2z = ...(4)
+        //   a11 E1^2 + a22 E2^2 + a12 E1E2 + a10 E1 + a01 E2 + a00 = 0, id. with bij
+        struct Coefficients {
+            T alpha1, beta1, gamma1;
+            T alpha2, beta2, gamma2;
+            T alpha3, beta3, gamma3;
+            T alpha4, beta4, gamma4;
+            T alpha5, beta5, gamma5;
+            T alpha6, beta6, gamma6;
+
+            T a11, a22, a12, a10, a01, a00;
+            T b11, b22, b12, b10, b01, b00;
+        };
+
+        // Squared invariant masses of a (lepton, b-jet) pair and of its two objects, used by the pre-filter
+        struct PairMasses {
+            T mlb_2;
+            T ml_2;
+            T mb_2;
+        };
+
+        // Mass-independent part of the coefficients for one set of inputs, computed once to solve for several mass hypotheses.
+        // Only the alpha, beta and quadratic terms of `coefficients` are filled.
+        struct MassIndependentCoefficients {
+            Coefficients coefficients;
+            NeutrinosSolverMassIndependentTerms<T> terms;
+            // Masses of the (lepton, b-jet) pairs, for the pre-filter
+            PairMasses masses1, masses2;
+        };
+
+        // Part of the coefficients depending on only one (lepton, b-jet) pair, computed once for all the sets of inputs
+        // sharing this pair, whichever side it is on: both assignments of the b-jets to the leptons, and all the candidates
+        // made of the same objects
+        struct PairCoefficients {
+            NeutrinosSolverPairTerms<T> terms;
+            // Masses of the pair, for the pre-filter
+            PairMasses masses;
+
+            LorentzVector lepton_p4() const { return LorentzVector(terms.lx, terms.ly, terms.lz, terms.lE); }
+            LorentzVector bjet_p4() const { return LorentzVector(terms.bx, terms.by, terms.bz, terms.bE); }
+        };
 
-        NeutrinosSolver(float top_mass, float w_mass):
+        // Mass hypothesis, the same for both tops and both Ws
+        struct Masses {
+            float top;
+            float w;
+        };
+
+        // Resolutions used to smear the inputs in the sampling mode
+        struct Resolutions {
+            T jet; // Relative resolution on the b-jets energy
+            T met; // Absolute resolution on each transverse component of the MET not coming from the b-jets
+        };
+
+        // Inputs and solutions of the sampling mode, for n variations of one set of inputs.
+        // Variation i is solved as set i of the batched version; the buffers are reused from one call to the next.
+        struct Samples {
+            P4Buffer lepton1_p4, lepton2_p4, bjet1_p4, bjet2_p4, met;
+            P4Buffer neutrino1_p4, neutrino2_p4;
+            std::vector<uint8_t> n_solutions;
+
+            size_t size() const { return n_solutions.size(); }
+        };
+
+        // Pre-filter, rejecting the sets of inputs which cannot have any solution before solving for them
+        struct PreFilter {
+            bool enabled = false;
+            // Maximal invariant mass of each (lepton, b-jet) pair. A negative value means using the kinematic endpoint: from
+            // t = l + nu + b, m(l,b)^2 = mt^2 - mW^2 + m(l)^2 - 2 nu.b <= mt^2 - mW^2 + m(l)^2, which does not reject any
+            // solution. It relies on nu.b >= 0, so it is not applied to b-jets with a negative squared mass.
+            T max_mlb = -1;
+            // Minimal |pz| of the b-jets, which the coefficients are divided by
+            T min_bjet_abs_pz = 1e-3;
+        };
+
+        // Number of sets of inputs seen by the pre-filter, and rejected for each reason
+        struct PreFilterCounters {
+            uint64_t tested = 0;
+            uint64_t rejected_bjet_pz = 0;
+            uint64_t rejected_mlb = 0;
+        };
+
+        // Statistics accumulated over all the calls, to monitor the solver in production
+        struct Statistics {
+            // Number of sets of inputs given to the solver (one per scalar call, n per batched call), and actually solved
+            // (i.e. passing the pre-filter)
+            uint64_t calls = 0;
+            uint64_t solved = 0;
+            // Number of solved sets of inputs having 0 to maxSolutions solutions with positive energies
+            std::array<uint64_t, maxSolutions + 1> n_solutions = {};
+            // Degenerate branches taken while intersecting the conics
+            ConicsBranchCounters branches;
+            // Cumulative time (in seconds) spent in getNeutrinos, only measured if enabled with setTiming()
+            double time = 0;
+        };
+
+        BasicNeutrinosSolver(float top_mass, float w_mass):
             t_mass(top_mass), w_mass(w_mass) {
             // Empty
         }
 
-        std::vector<std::pair<LorentzVector, LorentzVector>> getNeutrinos(const LorentzVector& lepton1_p4, 
-                const LorentzVector& lepton2_p4, 
-                const LorentzVector& bjet1_p4, 
+        void setPreFilter(const PreFilter& filter) { m_preFilter = filter; }
+        const PreFilterCounters& preFilterCounters() const { return m_preFilterCounters; }
+
+        // Measuring the time reads the clock twice per call, which is not negligible for the scalar versions
+        void setTiming(bool enabled) { m_timing = enabled; }
+        const Statistics& statistics() const { return m_statistics; }
+
+        // The counters and statistics are not thread-safe: each thread must use its own copy of the solver.
+        // merge() adds the counters and statistics of such a copy to the ones of this solver, and resetCounters() clears them.
+        void merge(const BasicNeutrinosSolver& other);
+        void resetCounters() {
+            m_preFilterCounters = PreFilterCounters();
+            m_statistics = Statistics();
+        }
+
+        std::vector<std::pair<LorentzVector, LorentzVector>> getNeutrinos(const LorentzVector& lepton1_p4,
+                const LorentzVector& lepton2_p4,
+                const LorentzVector& bjet1_p4,
                 const LorentzVector& bjet2_p4,
                 const LorentzVector& met);
 
+        // Allocation-free version: the solutions are written at the beginning of `neutrinos`, and their number is returned
+        size_t getNeutrinos(const LorentzVector& lepton1_p4,
+                const LorentzVector& lepton2_p4,
+                const LorentzVector& bjet1_p4,
+                const LorentzVector& bjet2_p4,
+                const LorentzVector& met,
+                std::array<NeutrinosPair, maxSolutions>& neutrinos);
+
+        // Batched version, solving for n sets of inputs at once. Set i is made of the i-th element of each input array.
+        // The solutions of set i are written at indices [maxSolutions*i, maxSolutions*i + n_solutions[i]) of the output arrays,
+        // which must therefore hold at least maxSolutions*n elements.
+        void getNeutrinos(size_t n,
+                const ConstP4Array& lepton1_p4,
+                const ConstP4Array& lepton2_p4,
+                const ConstP4Array& bjet1_p4,
+                const ConstP4Array& bjet2_p4,
+                const ConstP4Array& met,
+                const P4Array& neutrino1_p4,
+                const P4Array& neutrino2_p4,
+                uint8_t* n_solutions);
+
+        // Sampling mode: solve n random variations of one set of inputs in a single batched call.
+        // In each variation, each b-jet four-momentum is scaled by 1 + resolutions.jet * g (g following a normal distribution),
+        // and the MET absorbs the opposite of the b-jets transverse momentum shift plus a normal smearing of width resolutions.met
+        // on each axis. The variations are fully determined by `seed`.
+        void getSmearedNeutrinos(const LorentzVector& lepton1_p4,
+                const LorentzVector& lepton2_p4,
+                const LorentzVector& bjet1_p4,
+                const LorentzVector& bjet2_p4,
+                const LorentzVector& met,
+                size_t n,
+                const Resolutions& resolutions,
+                uint64_t seed,
+                Samples& samples);
+
+        // Two-stage version: first compute the coefficients of each (lepton, b-jet) pair, then combine two pairs and solve.
+        // The results are identical to the ones of the other versions.
+        void computePairCoefficients(const LorentzVector& lepton_p4,
+                const LorentzVector& bjet_p4,
+                PairCoefficients& coefficients) const;
+
+        size_t getNeutrinos(const PairCoefficients& pair1,
+                const PairCoefficients& pair2,
+                const LorentzVector& met,
+                std::array<NeutrinosPair, maxSolutions>& neutrinos);
+
+        // Batched two-stage version: set i is made of the pairs pairs[pairs1[i]] (lepton 1, b-jet 1) and pairs[pairs2[i]]
+        // (lepton 2, b-jet 2), and of the i-th MET. The output layout is the same as for the batched version.
+        void getNeutrinos(size_t n,
+                const PairCoefficients* pairs,
+                const uint32_t* pairs1,
+                const uint32_t* pairs2,
+                const ConstP4Array& met,
+                const P4Array& neutrino1_p4,
+                const P4Array& neutrino2_p4,
+                uint8_t* n_solutions);
+
+        // Mass scan, in two steps: first compute the mass-independent part of the coefficients for one set of inputs,
+        // then solve for n mass hypotheses. The solutions of hypothesis k are written at indices [maxSolutions*k, maxSolutions*k + n_solutions[k])
+        // of the output arrays, as in the batched version. The masses given to the constructor are not used.
+        void computeMassIndependentCoefficients(const LorentzVector& lepton1_p4,
+                const LorentzVector& lepton2_p4,
+                const LorentzVector& bjet1_p4,
+                const LorentzVector& bjet2_p4,
+                const LorentzVector& met,
+                MassIndependentCoefficients& coefficients) const;
+
+        void getNeutrinos(const MassIndependentCoefficients& coefficients,
+                size_t n,
+                const Masses* masses,
+                const P4Array& neutrino1_p4,
+                const P4Array& neutrino2_p4,
+                uint8_t* n_solutions);
+
+        void computeCoefficients(const LorentzVector& lepton1_p4,
+                const LorentzVector& lepton2_p4,
+                const LorentzVector& bjet1_p4,
+                const LorentzVector& bjet2_p4,
+                const LorentzVector& met,
+                Coefficients& coefficients) const;
+
     private:
+        // Find the intersection of the 2 conics, and write the neutrino 4-momenta of the solutions with positive energies
+        // at index `offset` and following of the output arrays. Returns the number of solutions written.
+        uint8_t solveConics(const Coefficients& c, const P4Array& p1, const P4Array& p2, const size_t offset);
+
+        // Combine two pairs, and solve for them if they pass the pre-filter. Same conventions as solveConics.
+        uint8_t solvePairs(const PairCoefficients& pair1, const PairCoefficients& pair2, const T met_x, const T met_y,
+                const P4Array& p1, const P4Array& p2, const size_t offset);
+
+        static PairMasses pairMasses(T lx, T ly, T lz, T lE, T bx, T by, T bz, T bE);
+
+        // Result of the pre-filter for one set of inputs, updating the counters. pairi are the masses of the (lepton, b-jet) pairs.
+        bool passPreFilter(T b1z, T b2z, const PairMasses& pair1, const PairMasses& pair2, float top_mass, float w_mass);
+
+        // Number of sets of inputs processed together by the batched solver.
+        // The coefficients of a whole block are computed in a single, vectorizable loop before the conics are intersected one by one.
+        static const size_t blockSize = 16;
+
         float t_mass = 172.5;
         float w_mass = 80.4;
+
+        PreFilter m_preFilter;
+        PreFilterCounters m_preFilterCounters;
+
+        bool m_timing = false;
+        Statistics m_statistics;
 };
+
+using NeutrinosSolver = BasicNeutrinosSolver<double>;
@@ -4,6 +4,11 @@
 #include <utility>
 #include <vector>
 #include <limits>
+#include <memory>
+#include <deque>
+
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/flow_graph.h>
 
 #include <cp3_llbb/Framework/interface/MuonsProducer.h>
 #include <cp3_llbb/Framework/interface/JetsProducer.h>
@@ -11,12 +16,20 @@
 
 #include <cp3_llbb/TTAnalysis/interface/Types.h>
 #include <cp3_llbb/TTAnalysis/interface/Tools.h>
+#include <cp3_llbb/TTAnalysis/interface/CompactIndexLists.h>
+
+// Index lists branch, written as is or in compact form (see TTAnalyzer::indexBranch)
+#define INDEX_BRANCH(NAME) std::vector<std::vector<uint16_t>>& NAME = indexBranch(#NAME)
 
 class TTAnalyzer: public Framework::Analyzer {
     public:
         TTAnalyzer(const std::string& name, const ROOT::TreeGroup& tree_, const edm::ParameterSet& config):
             Analyzer(name, tree_, config),
 
+            // Needed to declare the index branches below, hence first
+            m_compactIndexBranches( config.getUntrackedParameter<bool>("compactIndexBranches", false) ),
+            m_deltaEncodeIndexBranches( config.getUntrackedParameter<bool>("deltaEncodeIndexBranches", false) ),
+
             // Not untracked as these parameters are mandatory
             m_electrons_producer(config.getParameter<std::string>("electronsProducer")),
             m_muons_producer(config.getParameter<std::string>("muonsProducer")),
@@ -42,57 +55,110 @@ class TTAnalyzer: public Framework::Analyzer {
             m_jetDRleptonCut( config.getUntrackedParameter<double>("jetDRleptonCut", 0.3) ),
             m_jetID( config.getUntrackedParameter<std::string>("jetID", "loose") ),
             m_jetCSVv2Name( config.getUntrackedParameter<std::string>("jetCSVv2Name", "pfCombinedInclusiveSecondaryVertexV2BJetTags") ),
+            m_jetIDSelector( jetIDFromName(m_jetID) ),
             m_jetCSVv2L( config.getUntrackedParameter<double>("jetCSVv2L", 0.605) ),
             m_jetCSVv2M( config.getUntrackedParameter<double>("jetCSVv2M", 0.89) ),
             m_jetCSVv2T( config.getUntrackedParameter<double>("jetCSVv2T", 0.97) ),
             
             m_hltDRCut( config.getUntrackedParameter<double>("hltDRCut", std::numeric_limits<float>::max()) ),
-            m_hltDPtCut( config.getUntrackedParameter<double>("hltDPtCut", std::numeric_limits<float>::max()) )
+            m_hltDPtCut( config.getUntrackedParameter<double>("hltDPtCut", std::numeric_limits<float>::max()) ),
+
+            m_neutrinosSolverSmearingSamples( config.getUntrackedParameter<unsigned int>("neutrinosSolverSmearingSamples", 0) ),
+            m_neutrinosSolverJetResolution( config.getUntrackedParameter<double>("neutrinosSolverJetResolution", 0.1) ),
+            m_neutrinosSolverMetResolution( config.getUntrackedParameter<double>("neutrinosSolverMetResolution", 20) ),
+            m_neutrinosSolverPreFilter( config.getUntrackedParameter<bool>("neutrinosSolverPreFilter", true) ),
+            m_neutrinosSolverMaxMlb( config.getUntrackedParameter<double>("neutrinosSolverMaxMlb", -1) ),
+            m_neutrinosSolverMinBJetAbsPz( config.getUntrackedParameter<double>("neutrinosSolverMinBJetAbsPz", 1e-3) ),
+            m_neutrinosSolverStatisticsBranches( config.getUntrackedParameter<bool>("neutrinosSolverStatisticsBranches", false) ),
+            m_neutrinosSolverParallelMinCandidates( config.getUntrackedParameter<unsigned int>("neutrinosSolverParallelMinCandidates", 0) ),
+            m_concurrentStages( config.getUntrackedParameter<bool>("concurrentStages", false) ),
+            m_workingPoints( config.getUntrackedParameter<std::vector<std::string>>("workingPoints", std::vector<std::string>()) ),
+            m_maxLeptonsForCombinatorics( config.getUntrackedParameter<unsigned int>("maxLeptonsForCombinatorics", 0) ),
+            m_maxJetsByPtForCombinatorics( config.getUntrackedParameter<unsigned int>("maxJetsByPtForCombinatorics", 0) ),
+            m_maxJetsByCSVv2ForCombinatorics( config.getUntrackedParameter<unsigned int>("maxJetsByCSVv2ForCombinatorics", 0) ),
+            m_maxDiLepDiJets( config.getUntrackedParameter<unsigned int>("maxDiLepDiJets", 0) )
         {
+            if (m_neutrinosSolverStatisticsBranches) {
+                m_neutrinosSolver_calls = &tree["neutrinosSolver_calls"].write<uint32_t>();
+                m_neutrinosSolver_nSolutions = &tree["neutrinosSolver_nSolutions"].write<std::vector<uint32_t>>();
+                m_neutrinosSolver_degenerate = &tree["neutrinosSolver_degenerate"].write<uint32_t>();
+                m_neutrinosSolver_time = &tree["neutrinosSolver_time"].write<float>();
+            }
         }
 
         virtual void analyze(const edm::Event&, const edm::EventSetup&, const ProducersManager&, const AnalyzersManager&, const CategoryManager&) override;
         virtual void registerCategories(CategoryManager& manager, const edm::ParameterSet&) override;
+        virtual void beginJob(MetadataManager&) override;
+        virtual void endJob(MetadataManager&) override;
+        virtual void beginRun(const edm::Run&, const edm::EventSetup&) override;
+
+    private:
+
+        // If true, the std::vector<std::vector<uint16_t>> index branches are only kept in memory (for the categories), and written
+        // in the compact form of CompactIndexLists.h instead, delta-encoded if m_deltaEncodeIndexBranches is true. The analyzer
+        // then owns the inner lists, which keep their capacity from one event to the next instead of being freed by TreeWrapper.
+        const bool m_compactIndexBranches;
+        const bool m_deltaEncodeIndexBranches;
 
-        BRANCH(electrons_IDIso, std::vector<std::vector<uint16_t>>);
-        BRANCH(muons_IDIso, std::vector<std::vector<uint16_t>>);
+        // In-memory index lists of the compact index branches, and the branches they are written to at the end of analyze().
+        // A deque, since the lists are referenced by the analyzer members and must not move.
+        struct CompactIndexBranch {
+            std::vector<std::vector<uint16_t>> lists;
+            std::vector<uint16_t>* indices;
+            std::vector<uint32_t>* offsets;
+        };
+        std::deque<CompactIndexBranch> m_compactIndexBranchesStorage;
+
+        std::vector<std::vector<uint16_t>>& indexBranch(const std::string& name);
+
+    public:
+
+        INDEX_BRANCH(electrons_IDIso);
+        INDEX_BRANCH(muons_IDIso);
 
         BRANCH(leptons, std::vector<TTAnalysis::Lepton>);
-        BRANCH(leptons_IDIso, std::vector<std::vector<uint16_t>>);
+        INDEX_BRANCH(leptons_IDIso);
 
         BRANCH(diLeptons, std::vector<TTAnalysis::DiLepton>);
-        BRANCH(diLeptons_IDIso, std::vector<std::vector<uint16_t>>);
+        INDEX_BRANCH(diLeptons_IDIso);
 
         BRANCH(selJets, std::vector<TTAnalysis::Jet>);
         BRANCH(selJets_selID, std::vector<uint16_t>);
         // ex.: selectedJets_..._DRCut[X][0] is the highest Pt selected jet with minDRjl>0.3 taking into account ID/Iso-X Leptons
-        BRANCH(selJets_selID_DRCut, std::vector<std::vector<uint16_t>>);
+        INDEX_BRANCH(selJets_selID_DRCut);
         // ex.: selectedBJets_..._PtOrdered[X][0] is the highest Pt selected jet with minDRjl>0.3 taking into account ID/Iso/Btag-X combination
-        BRANCH(selBJets_DRCut_BWP_PtOrdered, std::vector<std::vector<uint16_t>>);
-        BRANCH(selBJets_DRCut_BWP_CSVv2Ordered, std::vector<std::vector<uint16_t>>);
+        INDEX_BRANCH(selBJets_DRCut_BWP_PtOrdered);
+        INDEX_BRANCH(selBJets_DRCut_BWP_CSVv2Ordered);
 
         BRANCH(diJets, std::vector<TTAnalysis::DiJet>);
         // ex.: diJets_DRCut[X][0] is first diJet with minDRjl>0.3 taking into account ID/Iso-X Leptons
-        BRANCH(diJets_DRCut, std::vector<std::vector<uint16_t>>); 
+        INDEX_BRANCH(diJets_DRCut); 
         // ex.: diBJets_..._CSVv2Ordered[X][0] is the b-jet pair with highest CSVv2 values and with minDRjl>0.3 taking into account the leptonID/Iso/Btag-X combination
-        BRANCH(diBJets_DRCut_BWP_PtOrdered, std::vector<std::vector<uint16_t>>);
-        BRANCH(diBJets_DRCut_BWP_CSVv2Ordered, std::vector<std::vector<uint16_t>>);
+        INDEX_BRANCH(diBJets_DRCut_BWP_PtOrdered);
+        INDEX_BRANCH(diBJets_DRCut_BWP_CSVv2Ordered);
 
         // For all the following: indices are combinations of LeptonID/LeptonIso/(B-tagging working point)
 
         BRANCH(diLepDiJets, std::vector<TTAnalysis::DiLepDiJet>);
         
-        BRANCH(diLepDiJets_DRCut, std::vector<std::vector<uint16_t>>); // di-leptons of combined ID/Iso with di-jets built out of jets having minDRjl>cut taking into account lepton ID/Iso corresponding to the loosest combination of the two leptons of the object
-        BRANCH(diLepDiBJets_DRCut_BWP_PtOrdered, std::vector<std::vector<uint16_t>>);
-        BRANCH(diLepDiBJets_DRCut_BWP_CSVv2Ordered, std::vector<std::vector<uint16_t>>);
+        INDEX_BRANCH(diLepDiJets_DRCut); // di-leptons of combined ID/Iso with di-jets built out of jets having minDRjl>cut taking into account lepton ID/Iso corresponding to the loosest combination of the two leptons of the object
+        INDEX_BRANCH(diLepDiBJets_DRCut_BWP_PtOrdered);
+        INDEX_BRANCH(diLepDiBJets_DRCut_BWP_CSVv2Ordered);
 
         BRANCH(diLepDiJetsMet, std::vector<TTAnalysis::DiLepDiJetMet>);
         
-        BRANCH(diLepDiJetsMet_DRCut, std::vector<std::vector<uint16_t>>); 
-        BRANCH(diLepDiBJetsMet_DRCut_BWP_PtOrdered, std::vector<std::vector<uint16_t>>);
-        BRANCH(diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered, std::vector<std::vector<uint16_t>>);
+        INDEX_BRANCH(diLepDiJetsMet_DRCut); 
+        INDEX_BRANCH(diLepDiBJetsMet_DRCut_BWP_PtOrdered);
+        INDEX_BRANCH(diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered);
         
-        BRANCH(ttbar, std::vector<std::vector<std::vector<TTAnalysis::TTBar>>>);
+        // ttbar solutions of each DiLepDiJetMet candidate entering at least one combination of b-tagging working points, sorted by
+        // increasing mtt and stored once whatever the number of combinations: the solutions of diLepDiJetsMet[i] are
+        // ttbar[ttbar_offsets[i]] to ttbar[ttbar_offsets[i + 1]] (excluded). The candidates of each combination are the ones
+        // listed in diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered.
+        BRANCH(ttbar, std::vector<TTAnalysis::TTBar>);
+        BRANCH(ttbar_offsets, std::vector<uint32_t>);
+
+        BRANCH(combinatoricsCaps, uint8_t); // Caps applied to the combinatorics in this event, as a combination of TTAnalysis::CombinatoricsCap bits
 
         // Gen matching. All indexes are from the `genParticles` collection
         BRANCH(genParticles, std::vector<TTAnalysis::GenParticle>);
@@ -180,42 +246,163 @@ class TTAnalyzer: public Framework::Analyzer {
 
         const float m_jetPtCut, m_jetEtaCut, m_bJetEtaCut, m_jetPUID, m_jetDRleptonCut;
         const std::string m_jetID, m_jetCSVv2Name;
+        // m_jetID resolved at construction; an unknown name is a configuration error
+        const TTAnalysis::JetID::JetID m_jetIDSelector;
         const float m_jetCSVv2L, m_jetCSVv2M, m_jetCSVv2T;
 
         const float m_hltDRCut, m_hltDPtCut;
 
-        std::shared_ptr<NeutrinosSolver> m_neutrinos_solver;
-
-        static inline bool muonIDAccessor(const MuonsProducer& muons, const uint16_t index, const std::string& muonID){
-            if(index >= muons.p4.size())
-              throw edm::Exception(edm::errors::StdException, "Invalid muon index passed to ID accessor");
-
-            if(muonID == "loose")
-                return muons.isLoose[index];
-            
-            if(muonID == "medium")
-                return muons.isMedium[index];
-            
-            if(muonID == "tight")
-                return muons.isTight[index];
-            
-            throw edm::Exception(edm::errors::NotFound, "Unknown muonID passed to analyzer");
-        }
-        
-        static inline bool jetIDAccessor(const JetsProducer& jets, const uint16_t index, const std::string& jetID){
-            if(index >= jets.p4.size())
-              throw edm::Exception(edm::errors::StdException, "Invalid jet index passed to ID accessor");
-            
-            if(jetID == "loose")
-                return jets.passLooseID[index];
-            
-            if(jetID == "tight")
-                return jets.passTightID[index];
-            
-            if(jetID == "tightLeptonVeto")
-                return jets.passTightLeptonVetoID[index];
-            
-            throw edm::Exception(edm::errors::NotFound, "Unknown jetID passed to analyzer");
-        }
+        // Number of smeared variations of the inputs solved for when the nominal inputs have no solution (0 to disable),
+        // and the resolutions used for the smearing: relative on the b-jets energy, absolute (GeV) on each MET component
+        const unsigned int m_neutrinosSolverSmearingSamples;
+        const float m_neutrinosSolverJetResolution, m_neutrinosSolverMetResolution;
+
+        // Pre-filter of the inputs of the neutrinos solver: maximal m(l,b) (negative to use the kinematic endpoint
+        // sqrt(mt^2 - mW^2 + ml^2), which rejects no solution, see NeutrinosSolver::PreFilter) and minimal |pz| of the b-jets
+        const bool m_neutrinosSolverPreFilter;
+        const float m_neutrinosSolverMaxMlb, m_neutrinosSolverMinBJetAbsPz;
+
+        // If true, the statistics of the neutrinos solver for each event are stored in the branches below:
+        // number of sets of inputs, histogram of their number of solutions, number of degenerate branches taken, and time (s)
+        const bool m_neutrinosSolverStatisticsBranches;
+        uint32_t* m_neutrinosSolver_calls = nullptr;
+        std::vector<uint32_t>* m_neutrinosSolver_nSolutions = nullptr;
+        uint32_t* m_neutrinosSolver_degenerate = nullptr;
+        float* m_neutrinosSolver_time = nullptr;
+
+        // Minimal number of distinct candidates for the ttbar reconstruction of an event to be split into TBB tasks (0 to always
+        // run it serially). Each task uses its own copy of the neutrinos solver, whose statistics are merged back after the event;
+        // the time in the statistics is then summed over the tasks.
+        const unsigned int m_neutrinosSolverParallelMinCandidates;
+
+        // If true, the independent stages of analyze() run concurrently in a TBB flow graph; otherwise one after the other (see stages())
+        const bool m_concurrentStages;
+
+        // Combinations of working points computed (all of them if the `workingPoints` parameter is empty). The vectors indexed
+        // by combination keep their full size, so that indices are the same for any selection: unlisted entries are left empty.
+        const TTAnalysis::WorkingPoints m_workingPoints;
+
+        // Caps on the combinatorics of high-multiplicity events (0 for no cap). Only the leading leptons in pt are combined
+        // into DiLeptons; only the union of the leading jets in pt and of the leading jets in CSVv2 are combined into DiJets
+        // (all of them if both caps are 0); and at most m_maxDiLepDiJets DiLepDiJets are built, in the order of the DiLeptons.
+        // The leptons and jets collections themselves are not affected.
+        const unsigned int m_maxLeptonsForCombinatorics;
+        const unsigned int m_maxJetsByPtForCombinatorics, m_maxJetsByCSVv2ForCombinatorics;
+        const unsigned int m_maxDiLepDiJets;
+
+        // Neutrinos solvers for simulation and for data, which use different top and W masses
+        struct NeutrinosSolvers {
+            NeutrinosSolver mc, data;
+
+            NeutrinosSolver& get(bool isRealData) { return isRealData ? data : mc; }
+            // Add the statistics of `other` to the ones of these solvers, and reset them in `other`
+            void merge(NeutrinosSolvers& other) {
+                mc.merge(other.mc);
+                data.merge(other.data);
+                other.mc.resetCounters();
+                other.data.resetCounters();
+            }
+        };
+
+        // Per-thread state of the parallel ttbar reconstruction: copies of the configured solvers, and the buffers of the sampling mode
+        struct MttWorker {
+            NeutrinosSolvers solvers;
+            NeutrinosSolver::Samples samples;
+        };
+
+        // Scratch storage of the ttbar reconstruction (see analyze), kept across events to reuse its capacity
+        struct MttScratch {
+            std::vector<int32_t> candidate_slot;
+            std::vector<uint16_t> candidates;
+            std::vector<int32_t> pair_slot;
+            std::vector<NeutrinosSolver::PairCoefficients> pairs;
+            std::vector<uint32_t> pairs1, pairs2;
+            NeutrinosSolver::P4Buffer met_p4, neutrino1_p4, neutrino2_p4;
+            std::vector<uint8_t> n_solutions;
+            std::vector<std::vector<TTAnalysis::TTBar>> solutions;
+            NeutrinosSolver::Samples samples;
+        };
+
+        // Everything analyze() modifies besides the output branches: the neutrinos solvers (whose statistics are updated by
+        // each call) and the scratch storage reused from one event to the next. There is a single context, and the branches
+        // are members of the analyzer: analyze() processes one event at a time.
+        struct EventContext {
+            EventContext(const NeutrinosSolvers& solvers): neutrinosSolvers(solvers) {}
+
+            NeutrinosSolvers neutrinosSolvers;
+            // Only created if the ttbar reconstruction may run in parallel (see m_neutrinosSolverParallelMinCandidates)
+            std::unique_ptr<tbb::enumerable_thread_specific<MttWorker>> mttWorkers;
+
+            // Flow graph of the stages, only created if they run concurrently (see m_concurrentStages). It is built once,
+            // and its nodes process the event and producers set here by analyze().
+            struct StagesGraph {
+                tbb::flow::graph graph;
+                tbb::flow::broadcast_node<tbb::flow::continue_msg> start{graph};
+                std::vector<std::unique_ptr<tbb::flow::continue_node<tbb::flow::continue_msg>>> nodes;
+                const edm::Event* event = nullptr;
+                const ProducersManager* producers = nullptr;
+            };
+            std::unique_ptr<StagesGraph> stagesGraph;
+
+            // Kinematics of the selected leptons, jets and of the MET, filled once per event (see TTAnalysis::Kinematics)
+            TTAnalysis::Kinematics leptonsKinematics, jetsKinematics, metKinematics;
+            // Lepton-jet distances, and distances of the leptons and jets to the MET (one column, indexed by object)
+            TTAnalysis::Distances leptonJetDistances, leptonMetDistances, jetMetDistances;
+
+            // Indices to the selected jets entering the DiJets, and scratch storage to find them
+            std::vector<uint16_t> combinatoricsJets;
+            std::vector<uint8_t> combinatoricsJetsSelected;
+
+            // CSVv2 ordering: sort key of each DiJet (sum of the discriminants of its jets), scratch storage for the keys and the
+            // order of the current family of objects, from which the CSVv2-ordered lists of all the combinations are derived
+            std::vector<float> diJetsCSVv2, csvv2Keys;
+            std::vector<uint16_t> csvv2Order;
+            TTAnalysis::IndexListsOrderer csvv2Orderer;
+
+            MttScratch mtt;
+
+            // Leptons selected by the electrons and muons stages, merged into the leptons by the DiLeptons stage
+            std::vector<TTAnalysis::Lepton> selectedElectrons, selectedMuons;
+
+            // Whether the HLT matching of each lepton has already been tried, even if no match was found
+            std::vector<uint8_t> leptonsHLTMatchTried;
+
+            // The b-tagger and electron ID names can only be checked against the producers: this is done on the first event
+            // of each run having jets (resp. electrons), which then fails with a configuration error instead of later in the job
+            bool bTaggerChecked = false;
+            bool electronIDsChecked = false;
+
+            // Whether the generator classification found a ttbar decay, to be matched to the reconstructed objects
+            bool genTTbarClassified = false;
+        };
+
+        // Created at the beginning of the job
+        std::unique_ptr<EventContext> m_context;
+
+        NeutrinosSolvers makeNeutrinosSolvers() const;
+        void buildStagesGraph(EventContext& context);
+
+        // Stages of analyze(). Each one only reads the outputs of its dependencies (besides the producers and the configuration),
+        // and the stages not depending on each other write disjoint outputs.
+        typedef void (TTAnalyzer::*StageFunction)(const edm::Event&, const ProducersManager&, EventContext&);
+        struct Stage {
+            StageFunction run;
+            // Indices in stages() of the stages to run before this one
+            std::vector<size_t> dependencies;
+        };
+        // Listed in an order compatible with their dependencies, used as is when running serially
+        static const std::vector<Stage>& stages();
+
+        void selectElectrons(const edm::Event&, const ProducersManager&, EventContext&);
+        void selectMuons(const edm::Event&, const ProducersManager&, EventContext&);
+        void buildDiLeptons(const edm::Event&, const ProducersManager&, EventContext&);
+        void selectJets(const edm::Event&, const ProducersManager&, EventContext&);
+        void buildDiJets(const edm::Event&, const ProducersManager&, EventContext&);
+        void buildCandidates(const edm::Event&, const ProducersManager&, EventContext&);
+        void matchTrigger(const edm::Event&, const ProducersManager&, EventContext&);
+        void classifyGen(const edm::Event&, const ProducersManager&, EventContext&);
+        void matchGen(const edm::Event&, const ProducersManager&, EventContext&);
+
+        static TTAnalysis::JetID::JetID jetIDFromName(const std::string& jetID);
 };
 
@@ -7,6 +7,8 @@
 #include <cp3_llbb/Framework/interface/Category.h>
 #include <cp3_llbb/Framework/interface/HLTProducer.h>
 
+#include <cp3_llbb/TTAnalysis/interface/Indices.h>
+
 namespace TTAnalysis{
 
 class DileptonCategory: public Category {
@@ -26,6 +28,25 @@ class DileptonCategory: public Category {
         m_HLTDoubleEGRegex.push_back( boost::regex(hlt, boost::regex_constants::icase) );
       for(const auto& hlt: m_HLTMuonEG)
         m_HLTMuonEGRegex.push_back( boost::regex(hlt, boost::regex_constants::icase) );
+
+      // Set by TTAnalyzer::registerCategories to the combinations of working points it computes
+      m_diLeptonWorkingPoints = WorkingPoints( conf.getUntrackedParameter<std::vector<std::string>>("workingPoints", std::vector<std::string>()) ).diLeptons();
+
+      // Build the names of the cuts once, rather than for each event
+      m_cutNames.clear();
+      for(const WorkingPoints::DiLepton& wp: m_diLeptonWorkingPoints){
+        std::string postFix("_");
+        postFix += LepLepIDIsoStr(wp.id1, wp.iso1, wp.id2, wp.iso2);
+
+        CutNames cuts;
+        cuts.category = baseStrCategory + postFix;
+        cuts.extraDiLeptonVeto = baseStrExtraDiLeptonVeto + postFix;
+        cuts.diLeptonTriggerMatch = baseStrDiLeptonTriggerMatch + postFix;
+        cuts.mll = baseStrMllCut + postFix;
+        cuts.mllZVeto = baseStrMllZVetoCut + postFix;
+        cuts.diLeptonIsOS = baseStrDiLeptonIsOS + postFix;
+        m_cutNames.push_back(cuts);
+      }
     }
 
     DileptonCategory():
@@ -44,6 +65,14 @@ class DileptonCategory: public Category {
     std::vector<std::string> m_HLTDoubleEG;
     std::vector<std::string> m_HLTMuonEG;
 
+    std::vector<WorkingPoints::DiLepton> m_diLeptonWorkingPoints;
+
+    // Names of the cuts for each of the combinations above
+    struct CutNames {
+      std::string category, extraDiLeptonVeto, diLeptonTriggerMatch, mll, mllZVeto, diLeptonIsOS;
+    };
+    std::vector<CutNames> m_cutNames;
+
     std::string baseStrCategory;
     std::string baseStrExtraDiLeptonVeto;
     std::string baseStrDiLeptonTriggerMatch;
@@ -3,117 +3,194 @@
 #include <cp3_llbb/TTAnalysis/interface/Types.h>
 #include <cp3_llbb/Framework/interface/JetsProducer.h>
 
+#include <Math/VectorUtil.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
 namespace TTAnalysis {
   
   float DeltaEta(const myLorentzVector &v1, const myLorentzVector &v2);
-  
-  // Used by std::sort to sort jets according to decreasing b-tagging discriminant value
-  class jetBTagDiscriminantSorter {
-    
-    public:
- 
-      // Either use indices to jets producer
-      jetBTagDiscriminantSorter(const JetsProducer& jets, const std::string& taggerName): 
-        m_jetsProducer(&jets),
-        m_taggerName(taggerName),
-        m_jetsArray(nullptr)
-        {}
-
-      // Or use indices to Jets array
-      jetBTagDiscriminantSorter(const JetsProducer& jets, const std::string& taggerName, const std::vector<Jet>& tt_jets): 
-        m_jetsProducer(&jets),
-        m_taggerName(taggerName),
-        m_jetsArray(&tt_jets)
-        {}
-      
-      bool operator()(uint16_t idxJet1, uint16_t idxJet2){
-        if(!m_jetsArray)
-          return m_jetsProducer->getBTagDiscriminant(idxJet1, m_taggerName) > m_jetsProducer->getBTagDiscriminant(idxJet2, m_taggerName);
-        else
-          return m_jetsProducer->getBTagDiscriminant(m_jetsArray->at(idxJet1).idx, m_taggerName) > m_jetsProducer->getBTagDiscriminant(m_jetsArray->at(idxJet2).idx, m_taggerName);
+
+  // Structure-of-arrays cache of the kinematics of the selected objects, filled once per object per event.
+  // Pair and combination builders read from it instead of going back to the Lorentz vectors:
+  // the Cartesian components are only computed once, and eta/phi are contiguous for the DR loops.
+  struct Kinematics {
+
+    // Minimal (eta, phi) view, so that VectorUtil gives the same results as on the full Lorentz vectors
+    struct EtaPhi {
+      typedef float Scalar;
+      EtaPhi(float eta, float phi): eta(eta), phi(phi) {}
+      Scalar Eta() const { return eta; }
+      Scalar Phi() const { return phi; }
+      float eta, phi;
+    };
+
+    std::vector<float> pt, eta, phi, E;
+    std::vector<float> px, py, pz;
+
+    size_t size() const { return pt.size(); }
+
+    void clear() {
+      pt.clear(); eta.clear(); phi.clear(); E.clear();
+      px.clear(); py.clear(); pz.clear();
+    }
+
+    void push_back(const myLorentzVector& p4) {
+      pt.push_back(p4.Pt());
+      eta.push_back(p4.Eta());
+      phi.push_back(p4.Phi());
+      E.push_back(p4.E());
+      px.push_back(p4.Px());
+      py.push_back(p4.Py());
+      pz.push_back(p4.Pz());
+    }
+
+    EtaPhi etaPhi(size_t i) const { return EtaPhi(eta[i], phi[i]); }
+
+    NeutrinosSolver::LorentzVector solverP4(size_t i) const {
+      return NeutrinosSolver::LorentzVector(px[i], py[i], pz[i], E[i]);
+    }
+
+    // Same as k1.p4(i1) + k2.p4(i2), without going through the (pt, eta, phi, E) coordinates again
+    static myLorentzVector sum(const Kinematics& k1, size_t i1, const Kinematics& k2, size_t i2) {
+      myLorentzVector p4;
+      p4.SetPxPyPzE(k1.px[i1] + k2.px[i2], k1.py[i1] + k2.py[i2], k1.pz[i1] + k2.pz[i2], k1.E[i1] + k2.E[i2]);
+      return p4;
+    }
+
+    static float DeltaR(const Kinematics& k1, size_t i1, const Kinematics& k2, size_t i2) {
+      return ROOT::Math::VectorUtil::DeltaR(k1.etaPhi(i1), k2.etaPhi(i2));
+    }
+
+    static float DeltaPhi(const Kinematics& k1, size_t i1, const Kinematics& k2, size_t i2) {
+      return ROOT::Math::VectorUtil::DeltaPhi(k1.etaPhi(i1), k2.etaPhi(i2));
+    }
+
+    static float DeltaEta(const Kinematics& k1, size_t i1, const Kinematics& k2, size_t i2) {
+      return std::abs(k1.eta[i1] - k2.eta[i2]);
+    }
+  };
+
+  // Angular distances between all the objects of two Kinematics caches, computed once per event so that
+  // the combination builders only do lookups. Entry (i1, i2) is at i1 * n2 + i2, and DPhi is signed as
+  // VectorUtil::DeltaPhi(k1[i1], k2[i2]). The storage is kept across events.
+  struct Distances {
+
+    std::vector<float> DR, DEta, DPhi;
+    size_t n2 = 0;
+
+    // Bits of float(pi), the smallest float above pi
+    static const int32_t FLOAT_PI_BITS = 0x40490fdb;
+
+    // The rows are computed straight from the eta and phi arrays, without branches, so that the loop can be vectorized.
+    // The results are bit-identical to the ones of VectorUtil::DeltaR and VectorUtil::DeltaPhi on (eta, phi) in float:
+    // the difference of phi is taken in float, and brought back into (-pi, pi] in double.
+    void compute(const Kinematics& k1, const Kinematics& k2) {
+      n2 = k2.size();
+      const size_t n = k1.size() * n2;
+      DR.resize(n);
+      DEta.resize(n);
+      DPhi.resize(n);
+
+      for(size_t i1 = 0; i1 < k1.size(); i1++){
+        const size_t row = i1 * n2;
+        computeRow(k1.eta[i1], k1.phi[i1], n2, k2.eta.data(), k2.phi.data(), DR.data() + row, DEta.data() + row, DPhi.data() + row);
       }
-  
+
+      // Separate loop, since the branch setting errno in std::sqrt would prevent the vectorization of the rows
+      // (this one is vectorized too with -fno-math-errno)
+      for(float& dR: DR)
+        dR = std::sqrt(dR);
+    }
+
+    size_t index(size_t i1, size_t i2) const { return i1 * n2 + i2; }
+
+    float dR(size_t i1, size_t i2) const { return DR[index(i1, i2)]; }
+
     private:
-  
-      const JetsProducer* const m_jetsProducer;
-      const std::string m_taggerName;
-      const std::vector<Jet>* const m_jetsArray;
+    // Squared DR, |DEta| and DPhi of one object against n others. The restrict qualifiers spare the compiler the
+    // run-time overlap checks between the arrays, which it does not emit at -O2.
+    static void computeRow(const float eta1, const float phi1, const size_t n, const float* __restrict__ eta2, const float* __restrict__ phi2,
+        float* __restrict__ dR2, float* __restrict__ dEta, float* __restrict__ dPhi) {
+
+      for(size_t i2 = 0; i2 < n; i2++){
+        const float deta = eta2[i2] - eta1;
+        const float dphi_raw = phi2[i2] - phi1;
+
+        // dphi_raw > pi and dphi_raw <= -pi are both |dphi_raw| >= float(pi), which is checked on the bits:
+        // a floating-point comparison could trap, and would keep gcc from turning the wrapping into selects at -O2
+        int32_t bits;
+        std::memcpy(&bits, &dphi_raw, sizeof(bits));
+        const int32_t outside = (bits & 0x7fffffff) >= FLOAT_PI_BITS;
+        const int32_t direction = 1 + 2 * (bits >> 31);
+        // +0 inside, which leaves dphi_raw unchanged (even if -0)
+        const float dphi = dphi_raw - (outside * direction) * (2.0 * M_PI);
 
+        dR2[i2] = dphi * dphi + deta * deta;
+        dEta[i2] = std::abs(deta);
+        dPhi[i2] = dphi;
+      }
+    }
   };
 
-  // Used by std::sort to sort DiJets according to decreasing b-tagging discriminant value
-  class diJetBTagDiscriminantSorter {
-    
+  // Mix `value` into `seed` (splitmix64 finalizer), to derive independent random seeds from event and candidate indices
+  inline uint64_t combineSeeds(uint64_t seed, uint64_t value) {
+    uint64_t z = seed ^ (value + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2));
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  
+  // Fills `order` with the indices 0 .. keys.size() - 1 sorted by decreasing key, ties being kept in increasing index order
+  inline void sortByDecreasingKey(const std::vector<float>& keys, std::vector<uint16_t>& order) {
+    order.resize(keys.size());
+    for(uint16_t i = 0; i < order.size(); i++)
+      order[i] = i;
+    std::sort(order.begin(), order.end(), [&keys](uint16_t a, uint16_t b){ return keys[a] > keys[b] || (keys[a] == keys[b] && a < b); });
+  }
+
+  // Orders the index lists of all the combinations of working points following one global order of the objects:
+  // ordered[i] receives the entries of lists[i], in the order in which they appear in `order`. This replaces a sort of
+  // each list by one sort of the objects, and the result is stable. Linear in the number of objects and of entries.
+  class IndexListsOrderer {
+
     public:
- 
-      // Either work directly on DiJet objects
-
-      diJetBTagDiscriminantSorter(const JetsProducer& jets, const std::string& taggerName): 
-        m_jetsProducer(jets), 
-        m_taggerName(taggerName) 
-        {}
-      
-      bool operator()(const DiJet& diJet1, const DiJet& diJet2){
-        return 
-          ( m_jetsProducer.getBTagDiscriminant(diJet1.idxs.first, m_taggerName) + m_jetsProducer.getBTagDiscriminant(diJet1.idxs.second, m_taggerName) ) > 
-          ( m_jetsProducer.getBTagDiscriminant(diJet2.idxs.first, m_taggerName) + m_jetsProducer.getBTagDiscriminant(diJet2.idxs.second, m_taggerName) );
-      }
 
-      // Or work on vectors containing indices pointing to jets themselves
-      // 1) Using DiJets
-      diJetBTagDiscriminantSorter(const JetsProducer& jets, const std::string& taggerName, const std::vector<DiJet>& diJets):  
-        m_jetsProducer(jets), 
-        m_taggerName(taggerName), 
-        m_diJets(&diJets), 
-        m_diLepDiJets(nullptr), 
-        m_diLepDiJetsMet(nullptr) 
-        {}
-      // 2) Using DiLepDiJets
-      diJetBTagDiscriminantSorter(const JetsProducer& jets, const std::string& taggerName, const std::vector<DiLepDiJet>& diLepDiJets):  
-        m_jetsProducer(jets), 
-        m_taggerName(taggerName), 
-        m_diJets(nullptr), 
-        m_diLepDiJets(&diLepDiJets), 
-        m_diLepDiJetsMet(nullptr) 
-        {}
-      // 3) Using DiLepDiJetsMet
-      diJetBTagDiscriminantSorter(const JetsProducer& jets, const std::string& taggerName, const std::vector<DiLepDiJetMet>& diLepDiJetsMet):  
-        m_jetsProducer(jets), 
-        m_taggerName(taggerName), 
-        m_diJets(nullptr), 
-        m_diLepDiJets(nullptr), 
-        m_diLepDiJetsMet(&diLepDiJetsMet) 
-        {}
-      
-      bool operator()(const uint16_t idx1, const uint16_t idx2){
-        
-        if(m_diJets){
-          return 
-            ( m_jetsProducer.getBTagDiscriminant((*m_diJets)[idx1].idxs.first, m_taggerName) + m_jetsProducer.getBTagDiscriminant((*m_diJets)[idx1].idxs.second, m_taggerName) ) > 
-            ( m_jetsProducer.getBTagDiscriminant((*m_diJets)[idx2].idxs.first, m_taggerName) + m_jetsProducer.getBTagDiscriminant((*m_diJets)[idx2].idxs.second, m_taggerName) );
-        
-        }else if(m_diLepDiJets){
-          return 
-            ( m_jetsProducer.getBTagDiscriminant((*m_diLepDiJets)[idx1].diJet->idxs.first, m_taggerName) + m_jetsProducer.getBTagDiscriminant((*m_diLepDiJets)[idx1].diJet->idxs.second, m_taggerName) ) > 
-            ( m_jetsProducer.getBTagDiscriminant((*m_diLepDiJets)[idx2].diJet->idxs.first, m_taggerName) + m_jetsProducer.getBTagDiscriminant((*m_diLepDiJets)[idx2].diJet->idxs.second, m_taggerName) );
-        
-        }else if(m_diLepDiJetsMet){
-          return 
-            ( m_jetsProducer.getBTagDiscriminant((*m_diLepDiJetsMet)[idx1].diJet->idxs.first, m_taggerName) + m_jetsProducer.getBTagDiscriminant((*m_diLepDiJetsMet)[idx1].diJet->idxs.second, m_taggerName) ) > 
-            ( m_jetsProducer.getBTagDiscriminant((*m_diLepDiJetsMet)[idx2].diJet->idxs.first, m_taggerName) + m_jetsProducer.getBTagDiscriminant((*m_diLepDiJetsMet)[idx2].diJet->idxs.second, m_taggerName) );
-        
-        }else{
-          return false;
+      void operator()(const std::vector<uint16_t>& order, const std::vector<std::vector<uint16_t>>& lists, std::vector<std::vector<uint16_t>>& ordered) {
+        // For each object, the lists it appears in: entries m_offsets[object] to m_offsets[object + 1] of m_listIds
+        m_offsets.assign(order.size() + 1, 0);
+        for(const std::vector<uint16_t>& list: lists){
+          for(const uint16_t& object: list)
+            m_offsets[object + 1]++;
+        }
+        for(size_t object = 0; object < order.size(); object++)
+          m_offsets[object + 1] += m_offsets[object];
+
+        m_listIds.resize(m_offsets.back());
+        m_cursors.assign(m_offsets.begin(), m_offsets.end() - 1);
+        for(uint16_t list = 0; list < lists.size(); list++){
+          for(const uint16_t& object: lists[list])
+            m_listIds[m_cursors[object]++] = list;
+        }
+
+        ordered.resize(lists.size());
+        for(std::vector<uint16_t>& list: ordered)
+          list.clear();
+        for(const uint16_t& object: order){
+          for(uint32_t entry = m_offsets[object]; entry < m_offsets[object + 1]; entry++)
+            ordered[m_listIds[entry]].push_back(object);
         }
       }
-    
+
     private:
-  
-      const JetsProducer& m_jetsProducer;
-      const std::string m_taggerName;
-      const std::vector<DiJet>* m_diJets; 
-      const std::vector<DiLepDiJet>* m_diLepDiJets; 
-      const std::vector<DiLepDiJetMet>* m_diLepDiJetsMet; 
+
+      // Scratch storage, kept across events
+      std::vector<uint32_t> m_offsets, m_cursors;
+      std::vector<uint16_t> m_listIds;
   };
 
 }
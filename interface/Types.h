@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <utility>
 #include <vector>
 #include <limits>
@@ -19,6 +22,49 @@ namespace TTAnalysis {
   // Forward declaration to use this here
   float DeltaEta(const myLorentzVector &v1, const myLorentzVector &v2);
 
+  // Fixed-width set of N flags (one per working point, or combination of working points), stored as the bits of an integer:
+  // flag i is bit i. Testing a flag is a shift and an AND, and several flags can be tested at once with all().
+  template<typename Bits, size_t N>
+  struct Flags {
+    static_assert(N <= 8 * sizeof(Bits), "Too many flags for the storage type");
+
+    Bits bits = 0;
+
+    static size_t size() { return N; }
+
+    bool operator[](size_t i) const { return (bits >> i) & 1; }
+
+    void set(size_t i, bool value) {
+      if(value)
+        bits |= Bits(1) << i;
+      else
+        bits &= ~(Bits(1) << i);
+    }
+
+    // True if all the flags set in `mask` are set
+    bool all(Bits mask) const { return (bits & mask) == mask; }
+  };
+
+  // Caps applied to the combinatorics of an event, stored as the bits of the `combinatoricsCaps` branch
+  namespace CombinatoricsCap {
+    enum CombinatoricsCap: uint8_t {
+      Leptons = 1 << 0, // Some leptons were left out of the DiLeptons (see `maxLeptonsForCombinatorics`)
+      Jets = 1 << 1, // Some jets were left out of the DiJets (see `maxJetsByPtForCombinatorics` and `maxJetsByCSVv2ForCombinatorics`)
+      DiLepDiJets = 1 << 2 // The DiLepDiJets were truncated (see `maxDiLepDiJets`)
+    };
+  }
+
+  using LepIDFlags = Flags<uint8_t, LepID::Count>;
+  using LepIsoFlags = Flags<uint8_t, LepIso::Count>;
+  using LepLepIDFlags = Flags<uint16_t, LepID::Count*LepID::Count>;
+  using LepLepIsoFlags = Flags<uint8_t, LepIso::Count*LepIso::Count>;
+  using JetIDFlags = Flags<uint8_t, JetID::Count>;
+  using BWPFlags = Flags<uint8_t, BWP::Count>;
+  using JetJetBWPFlags = Flags<uint16_t, BWP::Count*BWP::Count>;
+
+  // Minimal DR between a jet and the leptons, for each combination of a lepton ID and isolation
+  using LepIDIsoDR = std::array<float, LepID::Count*LepIso::Count>;
+
   struct BaseObject {
     BaseObject(myLorentzVector p4): p4(p4) {}
     BaseObject() {}
@@ -36,33 +82,28 @@ namespace TTAnalysis {
   };
 
   struct Lepton: BaseObject {
-    Lepton():
-      ID(LepID::Count, false),
-      iso(LepIso::Count, false)
-    {}
+    Lepton() {}
     Lepton(myLorentzVector p4, uint16_t idx, uint16_t charge, bool isEl, bool isMu, bool isVeto = false, bool isLoose = false, bool isMedium = false, bool isTight = false, float isoValue = 0, bool isoLoose = false, bool isoTight = false):
       BaseObject(p4), 
       idx(idx), 
       charge(charge),
       isoValue(isoValue),
       isEl(isEl), 
-      isMu(isMu),
-      ID(LepID::Count, false),
-      iso(LepIso::Count, false)
+      isMu(isMu)
       {
         if(isEl)
-          ID[LepID::V] = isVeto;
+          ID.set(LepID::V, isVeto);
         else
-          ID[LepID::V] = isLoose; // for muons, re-use Loose as Veto ID
-        ID[LepID::L] = isLoose;
-        ID[LepID::M] = isMedium;
-        ID[LepID::T] = isTight;
+          ID.set(LepID::V, isLoose); // for muons, re-use Loose as Veto ID
+        ID.set(LepID::L, isLoose);
+        ID.set(LepID::M, isMedium);
+        ID.set(LepID::T, isTight);
 
         if(isMu){
-          iso[LepIso::L] = isoLoose;
-          iso[LepIso::T] = isoTight;
+          iso.set(LepIso::L, isoLoose);
+          iso.set(LepIso::T, isoTight);
         }else{
-          iso[LepIso::L] = true;
+          iso.set(LepIso::L, true);
         }
       }
     
@@ -72,13 +113,11 @@ namespace TTAnalysis {
     int16_t hlt_idx = -1; // Index to the matched HLT object. -1 if no match
     bool isEl;
     bool isMu;
-    std::vector<bool> ID; // lepton ID: veto-loose-medium-tight
-    std::vector<bool> iso; // lepton Iso: loose-tight (only for muons -> electrons only have loose)
+    LepIDFlags ID; // lepton ID: veto-loose-medium-tight
+    LepIsoFlags iso; // lepton Iso: loose-tight (only for muons -> electrons only have loose)
 
-    float hlt_DR_matched_object;
-    float hlt_DPt_matched_object;
-
-    bool hlt_already_tried_matching = false; // Internal flag; if true, it means this lepton has already been matched to an online object, even if no match has been found.
+    float hlt_DR_matched_object = -1; // -1 if no match
+    float hlt_DPt_matched_object = -1; // -1 if no match
 
     int8_t pdg_id() const {
         int8_t id = (isEl) ? 11 : 13;
@@ -87,10 +126,7 @@ namespace TTAnalysis {
   };
   
   struct DiLepton: BaseObject {
-    DiLepton():
-      ID(LepID::Count*LepID::Count, false),
-      iso(LepIso::Count*LepIso::Count, false)
-      {}
+    DiLepton() {}
     
     std::pair<uint16_t, uint16_t> idxs; // stores indices to electron/muon arrays
     std::pair<uint16_t, uint16_t> lidxs; // stores indices to Lepton array
@@ -98,37 +134,34 @@ namespace TTAnalysis {
     bool isElEl, isElMu, isMuEl, isMuMu;
     bool isOS; // opposite sign
     bool isSF; // same flavour
-    std::vector<bool> ID; // combination of two lepton IDs
-    std::vector<bool> iso; // combination of two lepton isolations
+    LepLepIDFlags ID; // combination of two lepton IDs
+    LepLepIsoFlags iso; // combination of two lepton isolations
     float DR;
     float DEta;
     float DPhi;
   };
  
   struct Jet: BaseObject {
-    Jet():
-      ID(JetID::Count, false),
-      minDRjl_lepIDIso(LepID::Count*LepIso::Count, std::numeric_limits<float>::max()),
-      BWP(BWP::Count, false)
-      {}
+    Jet() {
+      minDRjl_lepIDIso.fill(std::numeric_limits<float>::max());
+    }
 
     uint16_t idx; // index to jet array
-    std::vector<bool> ID;
-    std::vector<float> minDRjl_lepIDIso; // defined for each combination of a lepton ID and isolation
+    JetIDFlags ID;
+    LepIDIsoDR minDRjl_lepIDIso; // defined for each combination of a lepton ID and isolation
     float CSVv2;
-    std::vector<bool> BWP;
+    BWPFlags BWP;
   };
   
   struct DiJet: BaseObject {
-    DiJet():
-      minDRjl_lepIDIso(LepID::Count*LepIso::Count, std::numeric_limits<float>::max()),
-      BWP(BWP::Count*BWP::Count, false)
-      {}
+    DiJet() {
+      minDRjl_lepIDIso.fill(std::numeric_limits<float>::max());
+    }
     
     std::pair<uint16_t, uint16_t> idxs; // stores indices to jets array
     std::pair<uint16_t, uint16_t> jidxs; // stores indices to TTAnalysis::Jet array
-    std::vector<float> minDRjl_lepIDIso; // defined for each combination of a lepton ID and isolation
-    std::vector<bool> BWP; // combination of two b-tagging working points
+    LepIDIsoDR minDRjl_lepIDIso; // defined for each combination of a lepton ID and isolation
+    JetJetBWPFlags BWP; // combination of two b-tagging working points
     float DR;
     float DEta;
     float DPhi;
@@ -164,18 +197,12 @@ namespace TTAnalysis {
 
   struct DiLepDiJetMet: DiLepDiJet {
     DiLepDiJetMet() {}
+    // The DiLepDiJet part is copied as is, only the MET-related quantities are computed
     DiLepDiJetMet(const DiLepDiJet& diLepDiJet, uint16_t diLepDiJetIdx, const myLorentzVector& MetP4, bool hasNoHFMet = false):
-      DiLepDiJet(*diLepDiJet.diLepton, diLepDiJet.diLepIdx, *diLepDiJet.diJet, diLepDiJet.diJetIdx),
+      DiLepDiJet(diLepDiJet),
       diLepDiJetIdx(diLepDiJetIdx),
       hasNoHFMet(hasNoHFMet)
     {
-      DiLepDiJet::minDRjl = diLepDiJet.minDRjl;
-      DiLepDiJet::maxDRjl = diLepDiJet.maxDRjl;
-      DiLepDiJet::minDEtajl = diLepDiJet.minDEtajl;
-      DiLepDiJet::maxDEtajl = diLepDiJet.maxDEtajl;
-      DiLepDiJet::minDPhijl = diLepDiJet.minDPhijl;
-      DiLepDiJet::maxDPhijl = diLepDiJet.maxDPhijl;
-      
       p4 += MetP4;
 
       DR_ll_Met = ROOT::Math::VectorUtil::DeltaR(diLepton->p4, MetP4);
@@ -187,9 +214,10 @@ namespace TTAnalysis {
       DPhi_ll_Met = ROOT::Math::VectorUtil::DeltaPhi(diLepton->p4, MetP4);
       DPhi_jj_Met = ROOT::Math::VectorUtil::DeltaPhi(diJet->p4, MetP4);
       
-      DR_lljj_Met = ROOT::Math::VectorUtil::DeltaR(diLepton->p4 + diJet->p4, MetP4);
-      DEta_lljj_Met = DeltaEta(diLepton->p4 + diJet->p4, MetP4);
-      DPhi_lljj_Met = ROOT::Math::VectorUtil::DeltaPhi(diLepton->p4 + diJet->p4, MetP4);
+      // diLepDiJet.p4 is the sum of the DiLepton and DiJet four-vectors
+      DR_lljj_Met = ROOT::Math::VectorUtil::DeltaR(diLepDiJet.p4, MetP4);
+      DEta_lljj_Met = DeltaEta(diLepDiJet.p4, MetP4);
+      DPhi_lljj_Met = ROOT::Math::VectorUtil::DeltaPhi(diLepDiJet.p4, MetP4);
     }
 
     uint16_t diLepDiJetIdx;
@@ -236,6 +264,11 @@ namespace TTAnalysis {
       float DR_tt;
       float DEta_tt;
       float DPhi_tt;
+
+      // Solutions obtained with the sampling mode of the neutrinos solver are averaged over the smeared variations of the inputs,
+      // and `weight` is the fraction of the variations having a solution. Nominal solutions are not smeared and have weight 1.
+      bool smeared = false;
+      float weight = 1;
   };
 
 }
@@ -1,105 +1,234 @@
 #include <string>
+#include <set>
+
+#include <FWCore/Utilities/interface/EDMException.h>
 
 #include <cp3_llbb/TTAnalysis/interface/Indices.h>
 
 namespace TTAnalysis {
   
+  // Each name table is filled on first use (function-local statics are initialized once, even with several threads)
+
   // Combination of Lepton ID + Lepton Isolation for a single lepton
-  uint16_t LepIDIso(const LepID::LepID& id, const LepIso::LepIso& iso){
-    return LepIso::Count * id + iso;
-  }
-  std::string LepIDIsoStr(const LepID::LepID& id, const LepIso::LepIso& iso){
-    return "ID" + LepID::map.at(id) + "_Iso" + LepIso::map.at(iso);
+  const std::string& LepIDIsoStr(const LepID::LepID& id, const LepIso::LepIso& iso){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(LepID::Count * LepIso::Count);
+      for(const LepID::LepID& id: LepID::it)
+        for(const LepIso::LepIso& iso: LepIso::it)
+          names[LepIDIso(id, iso)] = "ID" + LepID::map.at(id) + "_Iso" + LepIso::map.at(iso);
+      return names;
+    }();
+    return names[LepIDIso(id, iso)];
   }
 
   // Combination of Lepton ID for a DiLepton object
-  uint16_t LepLepID(const LepID::LepID& id1, const LepID::LepID& id2){
-    return LepID::Count * id1 +  id2;
-  }
-  std::string LepLepIDStr(const LepID::LepID& id1, const LepID::LepID& id2){
-    return LepID::map.at(id1) + LepID::map.at(id2);
+  const std::string& LepLepIDStr(const LepID::LepID& id1, const LepID::LepID& id2){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(LepID::Count * LepID::Count);
+      for(const LepID::LepID& id1: LepID::it)
+        for(const LepID::LepID& id2: LepID::it)
+          names[LepLepID(id1, id2)] = LepID::map.at(id1) + LepID::map.at(id2);
+      return names;
+    }();
+    return names[LepLepID(id1, id2)];
   }
 
   // Combination of Lepton Isolation for a DiLepton object
-  uint16_t LepLepIso(const LepIso::LepIso& iso1, const LepIso::LepIso& iso2){
-    return LepIso::Count * iso1 + iso2;
-  }
-  std::string LepLepIsoStr(const LepIso::LepIso& iso1, const LepIso::LepIso& iso2){
-    return LepIso::map.at(iso1) + LepIso::map.at(iso2);
+  const std::string& LepLepIsoStr(const LepIso::LepIso& iso1, const LepIso::LepIso& iso2){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(LepIso::Count * LepIso::Count);
+      for(const LepIso::LepIso& iso1: LepIso::it)
+        for(const LepIso::LepIso& iso2: LepIso::it)
+          names[LepLepIso(iso1, iso2)] = LepIso::map.at(iso1) + LepIso::map.at(iso2);
+      return names;
+    }();
+    return names[LepLepIso(iso1, iso2)];
   }
 
   // Combination of Lepton ID + Lepton Isolation for a DiLepton object
-  uint16_t LepLepIDIso(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2){
-    return LepIso::Count*LepID::Count*LepIso::Count * id1 + LepID::Count*LepIso::Count * iso1 + LepIso::Count * id2 + iso2;
-  }
-  std::string LepLepIDIsoStr(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2){
-    return "ID" + LepID::map.at(id1) + LepID::map.at(id2) + "_Iso" + LepIso::map.at(iso1) + LepIso::map.at(iso2);
+  const std::string& LepLepIDIsoStr(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(LepID::Count * LepIso::Count * LepID::Count * LepIso::Count);
+      for(uint16_t idx = 0; idx < names.size(); idx++)
+        names[idx] = "ID" + LepID::map.at(LepLepIDIsoID1(idx)) + LepID::map.at(LepLepIDIsoID2(idx)) + "_Iso" + LepIso::map.at(LepLepIDIsoIso1(idx)) + LepIso::map.at(LepLepIDIsoIso2(idx));
+      return names;
+    }();
+    return names[LepLepIDIso(id1, iso1, id2, iso2)];
   }
 
   // Combination of Jet IDs for two jets (NOTE: NOT USED FOR NOW)
-  uint16_t JetJetID(const JetID::JetID& id1, const JetID::JetID& id2){
-    return JetID::Count * id1 + id2;
-  }
-  std::string JetJetIDStr(const JetID::JetID& id1, const JetID::JetID& id2){
-    return JetID::map.at(id1) + JetID::map.at(id2);
+  const std::string& JetJetIDStr(const JetID::JetID& id1, const JetID::JetID& id2){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(JetID::Count * JetID::Count);
+      for(const JetID::JetID& id1: JetID::it)
+        for(const JetID::JetID& id2: JetID::it)
+          names[JetJetID(id1, id2)] = JetID::map.at(id1) + JetID::map.at(id2);
+      return names;
+    }();
+    return names[JetJetID(id1, id2)];
   }
   
   // Combination of Jet ID and B-tagging working point (NOTE: NOT USED FOR NOW)
-  uint16_t JetIDBWP(const JetID::JetID& id, const BWP::BWP& wp){
-    return BWP::Count * id + wp;
-  }
-  std::string JetIDBWPStr(const JetID::JetID& id, const BWP::BWP& wp){
-    return "ID" + JetID::map.at(id) + "_B" + BWP::map.at(wp);
+  const std::string& JetIDBWPStr(const JetID::JetID& id, const BWP::BWP& wp){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(JetID::Count * BWP::Count);
+      for(const JetID::JetID& id: JetID::it)
+        for(const BWP::BWP& wp: BWP::it)
+          names[JetIDBWP(id, wp)] = "ID" + JetID::map.at(id) + "_B" + BWP::map.at(wp);
+      return names;
+    }();
+    return names[JetIDBWP(id, wp)];
   }
   
   // Combination of Lepton ID + Lepton Isolation (one lepton) and B-tagging working point for one jet
-  uint16_t LepIDIsoJetBWP(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp){
-    return LepIso::Count*BWP::Count * id + BWP::Count * iso + wp;
-  }
-  std::string LepIDIsoJetBWPStr(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp){
-    return "ID" + LepID::map.at(id) + "_Iso" + LepIso::map.at(iso) + "_B" + BWP::map.at(wp);
+  const std::string& LepIDIsoJetBWPStr(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(LepID::Count * LepIso::Count * BWP::Count);
+      for(const LepID::LepID& id: LepID::it)
+        for(const LepIso::LepIso& iso: LepIso::it)
+          for(const BWP::BWP& wp: BWP::it)
+            names[LepIDIsoJetBWP(id, iso, wp)] = "ID" + LepID::map.at(id) + "_Iso" + LepIso::map.at(iso) + "_B" + BWP::map.at(wp);
+      return names;
+    }();
+    return names[LepIDIsoJetBWP(id, iso, wp)];
   }
 
   // Combination of B-tagging working points for two jets
-  uint16_t JetJetBWP(const BWP::BWP& wp1, const BWP::BWP& wp2){
-    return BWP::Count * wp1 + wp2;
-  }
-  std::string JetJetBWPStr(const BWP::BWP& wp1, const BWP::BWP& wp2){
-    return BWP::map.at(wp1) + BWP::map.at(wp2);
+  const std::string& JetJetBWPStr(const BWP::BWP& wp1, const BWP::BWP& wp2){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(BWP::Count * BWP::Count);
+      for(uint16_t idx = 0; idx < names.size(); idx++)
+        names[idx] = BWP::map.at(JetJetBWP1(idx)) + BWP::map.at(JetJetBWP2(idx));
+      return names;
+    }();
+    return names[JetJetBWP(wp1, wp2)];
   }
 
   // Combination of Jet ID and B-tagging working points for two jets (NOTE: NOT USED FOR NOW)
-  uint16_t JetJetIDBWP(const JetID::JetID& id1, const BWP::BWP& wp1, const JetID::JetID& id2, const BWP::BWP& wp2){
-    return 
-      BWP::Count*JetID::Count*BWP::Count * id1 + 
-                 JetID::Count*BWP::Count * wp1 + 
-                              BWP::Count * id2 + 
-                                           wp2 ;
-  }
-  std::string JetJetIDBWPStr(const JetID::JetID& id1, const BWP::BWP wp1, const JetID::JetID& id2, const BWP::BWP wp2){
-    return "ID" + JetID::map.at(id1) + JetID::map.at(id2) + "_B" + BWP::map.at(wp1) + BWP::map.at(wp2);
+  const std::string& JetJetIDBWPStr(const JetID::JetID& id1, const BWP::BWP wp1, const JetID::JetID& id2, const BWP::BWP wp2){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(JetID::Count * BWP::Count * JetID::Count * BWP::Count);
+      for(const JetID::JetID& id1: JetID::it)
+        for(const BWP::BWP& wp1: BWP::it)
+          for(const JetID::JetID& id2: JetID::it)
+            for(const BWP::BWP& wp2: BWP::it)
+              names[JetJetIDBWP(id1, wp1, id2, wp2)] = "ID" + JetID::map.at(id1) + JetID::map.at(id2) + "_B" + BWP::map.at(wp1) + BWP::map.at(wp2);
+      return names;
+    }();
+    return names[JetJetIDBWP(id1, wp1, id2, wp2)];
   }
   
   // Combination of Lepton ID + Lepton Isolation (one lepton) and B-tagging working points for two jets
-  uint16_t LepIDIsoJetJetBWP(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp1, const BWP::BWP& wp2){
-    return LepIso::Count*BWP::Count*BWP::Count * id + BWP::Count*BWP::Count * iso + BWP::Count * wp1 + wp2;
-  }
-  std::string LepIDIsoJetJetBWPStr(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp1, const BWP::BWP& wp2){
-    return "ID" + LepID::map.at(id) + "_Iso" + LepIso::map.at(iso) + "_B" + BWP::map.at(wp1) + BWP::map.at(wp2);
+  const std::string& LepIDIsoJetJetBWPStr(const LepID::LepID& id, const LepIso::LepIso& iso, const BWP::BWP& wp1, const BWP::BWP& wp2){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(LepID::Count * LepIso::Count * BWP::Count * BWP::Count);
+      for(const LepID::LepID& id: LepID::it)
+        for(const LepIso::LepIso& iso: LepIso::it)
+          for(const BWP::BWP& wp1: BWP::it)
+            for(const BWP::BWP& wp2: BWP::it)
+              names[LepIDIsoJetJetBWP(id, iso, wp1, wp2)] = "ID" + LepID::map.at(id) + "_Iso" + LepIso::map.at(iso) + "_B" + BWP::map.at(wp1) + BWP::map.at(wp2);
+      return names;
+    }();
+    return names[LepIDIsoJetJetBWP(id, iso, wp1, wp2)];
   }
   
   // Combination of Lepton ID, Lepton Isolation, and B-tagging working points for a two-lepton-two-b-jets object
-  uint16_t LepLepIDIsoJetJetBWP(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2, const BWP::BWP& wp1, const BWP::BWP& wp2){
-    return 
-      LepIso::Count*LepID::Count*LepIso::Count*BWP::Count*BWP::Count * id1  + 
-                    LepID::Count*LepIso::Count*BWP::Count*BWP::Count * iso1 + 
-                                 LepIso::Count*BWP::Count*BWP::Count * id2  + 
-                                               BWP::Count*BWP::Count * iso2 + 
-                                                          BWP::Count * wp1  + 
-                                                                       wp2  ;
+  const std::string& LepLepIDIsoJetJetBWPStr(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2, const BWP::BWP& wp1, const BWP::BWP& wp2){
+    return LepLepIDIsoJetJetBWPStr( LepLepIDIsoJetJetBWP(id1, iso1, id2, iso2, wp1, wp2) );
+  }
+  const std::string& LepLepIDIsoJetJetBWPStr(const uint16_t idx){
+    static const std::vector<std::string> names = [](){
+      std::vector<std::string> names(LepID::Count * LepIso::Count * LepID::Count * LepIso::Count * BWP::Count * BWP::Count);
+      for(uint16_t idx = 0; idx < names.size(); idx++){
+        const uint16_t lep = LepLepIDIsoJetJetBWPLepLepIDIso(idx);
+        const uint16_t b = LepLepIDIsoJetJetBWPJetJetBWP(idx);
+        names[idx] = "Lep_" + LepLepIDIsoStr(LepLepIDIsoID1(lep), LepLepIDIsoIso1(lep), LepLepIDIsoID2(lep), LepLepIDIsoIso2(lep)) + "_B" + JetJetBWPStr(JetJetBWP1(b), JetJetBWP2(b));
+      }
+      return names;
+    }();
+    return names[idx];
   }
-  std::string LepLepIDIsoJetJetBWPStr(const LepID::LepID& id1, const LepIso::LepIso& iso1, const LepID::LepID& id2, const LepIso::LepIso& iso2, const BWP::BWP& wp1, const BWP::BWP& wp2){
-    return "Lep_ID" + LepID::map.at(id1) + LepID::map.at(id2) + "_Iso" + LepIso::map.at(iso1) + LepIso::map.at(iso2) + "_B" + BWP::map.at(wp1) + BWP::map.at(wp2);
+
+  // The inverses must match the combinations
+  static_assert(LepLepIDIsoJetJetBWP(LepID::T, LepIso::L, LepID::M, LepIso::T, BWP::M, BWP::T) == BWP::Count*BWP::Count * LepLepIDIso(LepID::T, LepIso::L, LepID::M, LepIso::T) + JetJetBWP(BWP::M, BWP::T), "Inconsistent LepLepIDIsoJetJetBWP");
+  static_assert(LepLepIDIsoID1(LepLepIDIso(LepID::T, LepIso::L, LepID::M, LepIso::T)) == LepID::T && LepLepIDIsoIso1(LepLepIDIso(LepID::T, LepIso::L, LepID::M, LepIso::T)) == LepIso::L &&
+      LepLepIDIsoID2(LepLepIDIso(LepID::T, LepIso::L, LepID::M, LepIso::T)) == LepID::M && LepLepIDIsoIso2(LepLepIDIso(LepID::T, LepIso::L, LepID::M, LepIso::T)) == LepIso::T, "Inconsistent LepLepIDIso inverse");
+  static_assert(LepLepIDIsoLoosest(LepLepIDIso(LepID::T, LepIso::L, LepID::M, LepIso::T)) == LepIDIso(LepID::M, LepIso::L), "Inconsistent LepLepIDIsoLoosest");
+
+  WorkingPoints::WorkingPoints(const std::vector<std::string>& names) {
+    
+    // Parse the names, by matching them against the table of names of all the combinations
+    const uint16_t nCombinations = LepID::Count * LepIso::Count * LepID::Count * LepIso::Count * BWP::Count * BWP::Count;
+    std::set<uint16_t> selected;
+    for(const std::string& name: names){
+      uint16_t idx = 0;
+      while(idx < nCombinations && name != LepLepIDIsoJetJetBWPStr(idx))
+        idx++;
+      if(idx == nCombinations)
+        throw edm::Exception(edm::errors::Configuration, "Unknown working points combination '" + name + "' (expected e.g. 'Lep_IDTT_IsoTT_BMM')");
+      selected.insert(idx);
+    }
+
+    // Build the lists in the order of the nested loops
+    std::vector<bool> leptonSelected(LepID::Count * LepIso::Count, false);
+    std::vector<bool> leptonLoosest(LepID::Count * LepIso::Count, false);
+    std::vector<std::set<BWP::BWP>> leptonBWPs(LepID::Count * LepIso::Count);
+    std::vector<std::set<std::pair<BWP::BWP, BWP::BWP>>> leptonBWPPairs(LepID::Count * LepIso::Count);
+
+    for(const LepID::LepID& id1: LepID::it){
+      for(const LepID::LepID& id2: LepID::it){
+        for(const LepIso::LepIso& iso1: LepIso::it){
+          for(const LepIso::LepIso& iso2: LepIso::it){
+
+            DiLepton diLepton = { id1, iso1, id2, iso2, {} };
+            uint16_t minCombIDIso = LepLepIDIsoLoosest( LepLepIDIso(id1, iso1, id2, iso2) );
+
+            for(const BWP::BWP& wp1: BWP::it){
+              for(const BWP::BWP& wp2: BWP::it){
+                if( !names.empty() && !selected.count( LepLepIDIsoJetJetBWP(id1, iso1, id2, iso2, wp1, wp2) ) )
+                  continue;
+
+                diLepton.bwpPairs.push_back( std::make_pair(wp1, wp2) );
+                leptonBWPs[minCombIDIso].insert(wp1);
+                leptonBWPs[minCombIDIso].insert(wp2);
+                leptonBWPPairs[minCombIDIso].insert( std::make_pair(wp1, wp2) );
+              }
+            }
+
+            if(diLepton.bwpPairs.empty())
+              continue;
+
+            m_diLeptons.push_back(diLepton);
+            leptonSelected[LepIDIso(id1, iso1)] = true;
+            leptonSelected[LepIDIso(id2, iso2)] = true;
+            leptonSelected[minCombIDIso] = true;
+            leptonLoosest[minCombIDIso] = true;
+          }
+        }
+      }
+    }
+
+    for(const LepID::LepID& id: LepID::it){
+      for(const LepIso::LepIso& iso: LepIso::it){
+        uint16_t comb = LepIDIso(id, iso);
+        if(!leptonSelected[comb])
+          continue;
+
+        Lepton lepton = { id, iso, leptonLoosest[comb], {}, {} };
+        lepton.bwps.assign(leptonBWPs[comb].begin(), leptonBWPs[comb].end());
+        lepton.bwpPairs.assign(leptonBWPPairs[comb].begin(), leptonBWPPairs[comb].end());
+        m_leptons.push_back(lepton);
+      }
+    }
+  }
+
+  std::vector<std::string> WorkingPoints::names() const {
+    std::vector<std::string> result;
+    for(const DiLepton& diLepton: m_diLeptons){
+      for(const auto& wps: diLepton.bwpPairs)
+        result.push_back( LepLepIDIsoJetJetBWPStr(diLepton.id1, diLepton.iso1, diLepton.id2, diLepton.iso2, wps.first, wps.second) );
+    }
+    return result;
   }
 
 }
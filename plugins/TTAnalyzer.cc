@@ -4,6 +4,7 @@
 #include <cp3_llbb/TTAnalysis/interface/GenStatusFlags.h>
 #include <cp3_llbb/TTAnalysis/interface/TTAnalyzer.h>
 #include <cp3_llbb/TTAnalysis/interface/TTDileptonCategories.h>
+#include <cp3_llbb/TTAnalysis/interface/CompactIndexLists.h>
 
 #include <cp3_llbb/Framework/interface/MuonsProducer.h>
 #include <cp3_llbb/Framework/interface/ElectronsProducer.h>
@@ -16,6 +17,14 @@
 #include <Math/LorentzVector.h>
 #include <Math/VectorUtil.h>
 
+#include <FWCore/Utilities/interface/EDMException.h>
+
+#include <stdexcept>
+
+#include <tbb/blocked_range.h>
+#include <tbb/flow_graph.h>
+#include <tbb/parallel_for.h>
+
 // To access VectorUtil::DeltaR() more easily
 using namespace ROOT::Math;
 
@@ -33,6 +42,13 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
 
   // Initizalize vectors depending on IDs/WPs to the right lengths
   // Only a resize() is needed (and no assign()), since TreeWrapper clears the vectors after each event.
+  // The in-memory lists of the compact index branches are not known to TreeWrapper, and are cleared here: only the inner
+  // lists are, so that they keep their capacity from one event to the next and the resize() below is a no-op.
+
+  for (CompactIndexBranch& branch: m_compactIndexBranchesStorage) {
+    for (std::vector<uint16_t>& list: branch.lists)
+      list.clear();
+  }
 
   electrons_IDIso.resize( LepID::Count * LepIso::Count );
   muons_IDIso.resize( LepID::Count * LepIso::Count );
@@ -56,7 +72,6 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
   diLepDiBJetsMet_DRCut_BWP_PtOrdered.resize( LepID::Count * LepIso::Count * LepID::Count * LepIso::Count * BWP::Count * BWP::Count );
   diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered.resize( LepID::Count * LepIso::Count * LepID::Count * LepIso::Count * BWP::Count * BWP::Count );
   
-  ttbar.resize( LepID::Count * LepIso::Count * LepID::Count * LepIso::Count * BWP::Count * BWP::Count );
 
   gen_matched_b.resize( LepID::Count * LepIso::Count , -1);
   gen_matched_b_beforeFSR.resize( LepID::Count * LepIso::Count , -1);
@@ -67,16 +82,64 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
   gen_bbar_deltaR.resize( LepID::Count * LepIso::Count );
   gen_bbar_beforeFSR_deltaR.resize( LepID::Count * LepIso::Count );
 
-  if (!m_neutrinos_solver.get()) {
-    const float topMass = event.isRealData() ? 173.34 : 172.5;
-    // const float topWidth = event.isRealData() ? 1.41 : 1.50833649;
+  EventContext& context = *m_context;
 
-    const float wMass = event.isRealData() ? 80.385 : 80.419002;
-    // const float wWidth = event.isRealData() ? 2.085 : 2.04759951;
+  // Run the stages, either one after the other in the order of stages(), or as a flow graph following their dependencies
+  if (!m_concurrentStages) {
+    for (const Stage& stage: stages())
+      (this->*stage.run)(event, producers, context);
+  } else {
+    EventContext::StagesGraph& graph = *context.stagesGraph;
+    graph.event = &event;
+    graph.producers = &producers;
 
-    m_neutrinos_solver.reset(new NeutrinosSolver(topMass, wMass));
+    graph.start.try_put(tbb::flow::continue_msg());
+    graph.graph.wait_for_all();
   }
 
+  for (const CompactIndexBranch& branch: m_compactIndexBranchesStorage)
+    encodeIndexLists(branch.lists, m_deltaEncodeIndexBranches, *branch.indices, *branch.offsets);
+
+  #ifdef _TT_DEBUG_
+    std::cout << "End event." << std::endl;
+  #endif
+}
+
+std::vector<std::vector<uint16_t>>& TTAnalyzer::indexBranch(const std::string& name) {
+
+  if (!m_compactIndexBranches)
+    return tree[name].write<std::vector<std::vector<uint16_t>>>();
+
+  m_compactIndexBranchesStorage.emplace_back();
+  CompactIndexBranch& branch = m_compactIndexBranchesStorage.back();
+  branch.indices = &tree[name + (m_deltaEncodeIndexBranches ? "_deltas" : "_indices")].write<std::vector<uint16_t>>();
+  branch.offsets = &tree[name + "_offsets"].write<std::vector<uint32_t>>();
+
+  return branch.lists;
+}
+
+const std::vector<TTAnalyzer::Stage>& TTAnalyzer::stages() {
+  enum { Electrons, Muons, DiLeptons, Jets, DiJets, Candidates, Trigger, GenClassification, GenMatching };
+
+  // Indexed by the enumeration above
+  static const std::vector<Stage> stages = {
+    { &TTAnalyzer::selectElectrons, {} },
+    { &TTAnalyzer::selectMuons, {} },
+    { &TTAnalyzer::buildDiLeptons, { Electrons, Muons } },
+    { &TTAnalyzer::selectJets, {} },
+    { &TTAnalyzer::buildDiJets, { DiLeptons, Jets } },
+    { &TTAnalyzer::buildCandidates, { DiJets } },
+    // Only fills the HLT matching fields of the leptons and DiLeptons, which the stages running concurrently do not read
+    { &TTAnalyzer::matchTrigger, { DiLeptons } },
+    { &TTAnalyzer::classifyGen, {} },
+    { &TTAnalyzer::matchGen, { DiJets, GenClassification } }
+  };
+
+  return stages;
+}
+
+void TTAnalyzer::selectElectrons(const edm::Event& event, const ProducersManager& producers, EventContext& context) {
+
   ///////////////////////////
   //       ELECTRONS       //
   ///////////////////////////
@@ -86,6 +149,15 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
   #endif
 
   const ElectronsProducer& electrons = producers.get<ElectronsProducer>(m_electrons_producer);
+  context.selectedElectrons.clear();
+
+  if(!context.electronIDsChecked && electrons.p4.size() > 0){
+    for(const std::string* name: { &m_electronVetoIDName, &m_electronLooseIDName, &m_electronMediumIDName, &m_electronTightIDName }){
+      if(!electrons.ids[0].count(*name))
+        throw edm::Exception(edm::errors::Configuration, "Unknown electron ID '" + *name + "'");
+    }
+    context.electronIDsChecked = true;
+  }
 
   for(uint16_t ielectron = 0; ielectron < electrons.p4.size(); ielectron++){
     if( electrons.p4[ielectron].Pt() > m_electronPtCut && std::abs(electrons.p4[ielectron].Eta()) < m_electronEtaCut ){
@@ -95,24 +167,25 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
           ielectron, 
           electrons.charge[ielectron], 
           true, false,
-          electrons.ids[ielectron][m_electronVetoIDName],
-          electrons.ids[ielectron][m_electronLooseIDName],
-          electrons.ids[ielectron][m_electronMediumIDName],
-          electrons.ids[ielectron][m_electronTightIDName],
+          electrons.ids[ielectron].at(m_electronVetoIDName),
+          electrons.ids[ielectron].at(m_electronLooseIDName),
+          electrons.ids[ielectron].at(m_electronMediumIDName),
+          electrons.ids[ielectron].at(m_electronTightIDName),
           electrons.relativeIsoR03_withEA[ielectron]
       );
       
-      for(const LepID::LepID& id: LepID::it){
-        for(const LepIso::LepIso& iso: LepIso::it){ // loop over Iso not really needed since not considered for electrons (for the moment)
-          uint16_t idx = LepIDIso(id, iso);
-          if( m_lepton.ID[id] && m_lepton.iso[iso] )
-            electrons_IDIso[idx].push_back(ielectron);
-        }
+      for(const WorkingPoints::Lepton& wp: m_workingPoints.leptons()){ // Iso not really needed since not considered for electrons (for the moment)
+        uint16_t idx = LepIDIso(wp.id, wp.iso);
+        if( m_lepton.ID[wp.id] && m_lepton.iso[wp.iso] )
+          electrons_IDIso[idx].push_back(ielectron);
       }
       
-      leptons.push_back(m_lepton);
+      context.selectedElectrons.push_back(m_lepton);
     }
   }
+}
+
+void TTAnalyzer::selectMuons(const edm::Event& event, const ProducersManager& producers, EventContext& context) {
 
   ///////////////////////////
   //       MUONS           //
@@ -123,6 +196,7 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
   #endif
 
   const MuonsProducer& muons = producers.get<MuonsProducer>(m_muons_producer);
+  context.selectedMuons.clear();
 
   for(uint16_t imuon = 0; imuon < muons.p4.size(); imuon++){
     if(muons.p4[imuon].Pt() > m_muonPtCut && std::abs(muons.p4[imuon].Eta()) < m_muonEtaCut ){
@@ -141,32 +215,39 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
           muons.relativeIsoR04_deltaBeta[imuon] < m_muonTightIsoCut
       );
 
-      for(const LepID::LepID& id: LepID::it){
-        for(const LepIso::LepIso& iso: LepIso::it){
-          uint16_t idx = LepIDIso(id, iso);
-          if( m_lepton.ID[id] && m_lepton.iso[iso] )
-            muons_IDIso[idx].push_back(imuon);
-        }
+      for(const WorkingPoints::Lepton& wp: m_workingPoints.leptons()){
+        uint16_t idx = LepIDIso(wp.id, wp.iso);
+        if( m_lepton.ID[wp.id] && m_lepton.iso[wp.iso] )
+          muons_IDIso[idx].push_back(imuon);
       }
 
-      leptons.push_back(m_lepton);
+      context.selectedMuons.push_back(m_lepton);
     }
   }
+}
+
+void TTAnalyzer::buildDiLeptons(const edm::Event& event, const ProducersManager& producers, EventContext& context) {
+
+  // The electrons first, then the muons, as if both stages had filled the leptons one after the other
+  leptons.insert(leptons.end(), context.selectedElectrons.begin(), context.selectedElectrons.end());
+  leptons.insert(leptons.end(), context.selectedMuons.begin(), context.selectedMuons.end());
 
   // Sort the leptons vector according to Pt
   std::sort(leptons.begin(), leptons.end(), [](const Lepton& a, const Lepton &b){ return a.p4.Pt() > b.p4.Pt(); });
 
+  context.leptonsKinematics.clear();
+  for(const Lepton& lepton: leptons)
+    context.leptonsKinematics.push_back(lepton.p4);
+
   // Store indices to leptons for each ID/Iso combination
   for(uint16_t idx = 0; idx < leptons.size(); idx++){
-    for(const LepID::LepID& id: LepID::it){
-      for(const LepIso::LepIso& iso: LepIso::it){
+    for(const WorkingPoints::Lepton& wp: m_workingPoints.leptons()){
          
-        uint16_t comb = LepIDIso(id, iso);
-        const Lepton& m_lepton = leptons[idx];
-        if(m_lepton.ID[id] && m_lepton.iso[iso])
-          leptons_IDIso[comb].push_back(idx);
+      uint16_t comb = LepIDIso(wp.id, wp.iso);
+      const Lepton& m_lepton = leptons[idx];
+      if(m_lepton.ID[wp.id] && m_lepton.iso[wp.iso])
+        leptons_IDIso[comb].push_back(idx);
 
-      }
     }
   }
 
@@ -178,14 +259,23 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
     std::cout << "Dileptons" << std::endl;
   #endif
 
-  for(uint16_t i1 = 0; i1 < leptons.size(); i1++){
-    for(uint16_t i2 = i1 + 1; i2 < leptons.size(); i2++){
+  combinatoricsCaps = 0;
+
+  // Only the leading leptons in pt enter the combinatorics
+  uint16_t nCombinatoricsLeptons = leptons.size();
+  if(m_maxLeptonsForCombinatorics > 0 && leptons.size() > m_maxLeptonsForCombinatorics){
+    nCombinatoricsLeptons = m_maxLeptonsForCombinatorics;
+    combinatoricsCaps |= CombinatoricsCap::Leptons;
+  }
+
+  for(uint16_t i1 = 0; i1 < nCombinatoricsLeptons; i1++){
+    for(uint16_t i2 = i1 + 1; i2 < nCombinatoricsLeptons; i2++){
       const Lepton& l1 = leptons[i1];
       const Lepton& l2 = leptons[i2];
 
       DiLepton m_diLepton;
 
-      m_diLepton.p4 = l1.p4 + l2.p4; 
+      m_diLepton.p4 = Kinematics::sum(context.leptonsKinematics, i1, context.leptonsKinematics, i2);
       m_diLepton.idxs = std::make_pair(l1.idx, l2.idx); 
       m_diLepton.lidxs = std::make_pair(i1, i2); 
       m_diLepton.isElEl = l1.isEl && l2.isEl;
@@ -199,7 +289,7 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
       for(const LepID::LepID& id1: LepID::it){
         for(const LepID::LepID& id2: LepID::it){
           uint16_t idx = LepLepID(id1, id2);
-          m_diLepton.ID[idx] = l1.ID[id1] && l2.ID[id2];
+          m_diLepton.ID.set(idx, l1.ID[id1] && l2.ID[id2]);
         }
       }
 
@@ -207,13 +297,13 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
       for(const LepIso::LepIso& iso1: LepIso::it){
         for(const LepIso::LepIso& iso2: LepIso::it){
           uint16_t idx = LepLepIso(iso1, iso2);
-          m_diLepton.iso[idx] = l1.iso[iso1] && l2.iso[iso2];
+          m_diLepton.iso.set(idx, l1.iso[iso1] && l2.iso[iso2]);
         }
       }
       
-      m_diLepton.DR = VectorUtil::DeltaR(l1.p4, l2.p4);
-      m_diLepton.DEta = TTAnalysis::DeltaEta(l1.p4, l2.p4);
-      m_diLepton.DPhi = VectorUtil::DeltaPhi(l1.p4, l2.p4);
+      m_diLepton.DR = Kinematics::DeltaR(context.leptonsKinematics, i1, context.leptonsKinematics, i2);
+      m_diLepton.DEta = Kinematics::DeltaEta(context.leptonsKinematics, i1, context.leptonsKinematics, i2);
+      m_diLepton.DPhi = Kinematics::DeltaPhi(context.leptonsKinematics, i1, context.leptonsKinematics, i2);
 
       diLeptons.push_back(m_diLepton);
     }
@@ -223,24 +313,21 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
   for(uint16_t i = 0; i < diLeptons.size(); i++){
     const DiLepton& m_diLepton = diLeptons[i];
     
-    for(const LepID::LepID& id1: LepID::it){
-      for(const LepID::LepID& id2: LepID::it){
-        for(const LepIso::LepIso& iso1: LepIso::it){
-          for(const LepIso::LepIso& iso2: LepIso::it){
+    for(const WorkingPoints::DiLepton& wp: m_workingPoints.diLeptons()){
             
-            uint16_t idx_ids = LepLepID(id1, id2);
-            uint16_t idx_isos = LepLepIso(iso1, iso2);
-            uint16_t idx_comb = LepLepIDIso(id1, iso1, id2, iso2);
+      uint16_t idx_ids = LepLepID(wp.id1, wp.id2);
+      uint16_t idx_isos = LepLepIso(wp.iso1, wp.iso2);
+      uint16_t idx_comb = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
 
-            if(m_diLepton.ID[idx_ids] && m_diLepton.iso[idx_isos])
-              diLeptons_IDIso[idx_comb].push_back(i);
+      if(m_diLepton.ID[idx_ids] && m_diLepton.iso[idx_isos])
+        diLeptons_IDIso[idx_comb].push_back(i);
           
-          }
-        }
-      }
     }
     
   }
+}
+
+void TTAnalyzer::selectJets(const edm::Event& event, const ProducersManager& producers, EventContext& context) {
 
   ///////////////////////////
   //       JETS            //
@@ -254,7 +341,16 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
 
   // First find the jets passing kinematic cuts and save them as Jet objects
 
-  uint16_t jetCounter(0);
+  if(!context.bTaggerChecked && jets.p4.size() > 0){
+    try {
+      jets.getBTagDiscriminant(0, m_jetCSVv2Name);
+    } catch (const std::out_of_range&) {
+      throw edm::Exception(edm::errors::Configuration, "Unknown b-tagging discriminant '" + m_jetCSVv2Name + "'");
+    }
+    context.bTaggerChecked = true;
+  }
+
+  context.jetsKinematics.clear();
   for(uint16_t ijet = 0; ijet < jets.p4.size(); ijet++){
     // Save the jets that pass the kinematic cuts
     if (std::abs(jets.p4[ijet].Eta()) < m_jetEtaCut && jets.p4[ijet].Pt() > m_jetPtCut){
@@ -262,60 +358,63 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
       
       m_jet.p4 = jets.p4[ijet];
       m_jet.idx = ijet;
-      m_jet.ID[JetID::L] = jets.passLooseID[ijet]; 
-      m_jet.ID[JetID::T] = jets.passTightID[ijet]; 
-      m_jet.ID[JetID::TLV] = jets.passTightLeptonVetoID[ijet];
+      m_jet.ID.set(JetID::L, jets.passLooseID[ijet]);
+      m_jet.ID.set(JetID::T, jets.passTightID[ijet]);
+      m_jet.ID.set(JetID::TLV, jets.passTightLeptonVetoID[ijet]);
       m_jet.CSVv2 = jets.getBTagDiscriminant(ijet, m_jetCSVv2Name);
-      m_jet.BWP[BWP::L] = m_jet.CSVv2 > m_jetCSVv2L;
-      m_jet.BWP[BWP::M] = m_jet.CSVv2 > m_jetCSVv2M;
-      m_jet.BWP[BWP::T] = m_jet.CSVv2 > m_jetCSVv2T;
-      
-      // Save minimal DR(l,j) using selected leptons, for each Lepton ID/Iso
-      for(const LepID::LepID& id: LepID::it){
-        for(const LepIso::LepIso& iso: LepIso::it){
-              
-          uint16_t idx_comb = LepIDIso(id, iso);
-          
-          for(const uint16_t& lepIdx: leptons_IDIso[idx_comb]){
-            const Lepton& m_lepton = leptons[lepIdx];
-            float DR = (float) VectorUtil::DeltaR(jets.p4[ijet], m_lepton.p4);
-            if( DR < m_jet.minDRjl_lepIDIso[idx_comb] )
-              m_jet.minDRjl_lepIDIso[idx_comb] = DR;
-          }
-          
-          // Save the indices to Jets passing the selected jetID and minDRjl > cut for this lepton ID/Iso
-          if( m_jet.minDRjl_lepIDIso[idx_comb] > m_jetDRleptonCut && jetIDAccessor(jets, ijet, m_jetID) ){
-            selJets_selID_DRCut[idx_comb].push_back(jetCounter);
-
-            // Out of these, save the indices for different b-tagging working points
-            for(const BWP::BWP& wp: BWP::it){
-              uint16_t idx_comb_b = LepIDIsoJetBWP(id, iso, wp);
-              if ((m_jet.BWP[wp]) && (std::abs(m_jet.p4.Eta()) < m_bJetEtaCut))
-                selBJets_DRCut_BWP_PtOrdered[idx_comb_b].push_back(jetCounter);
-            }
-          }
-        }
-      }
-      
-      if(jetIDAccessor(jets, ijet, m_jetID)) // Save the indices to Jets passing the selected jet ID
-        selJets_selID.push_back(jetCounter);
+      m_jet.BWP.set(BWP::L, m_jet.CSVv2 > m_jetCSVv2L);
+      m_jet.BWP.set(BWP::M, m_jet.CSVv2 > m_jetCSVv2M);
+      m_jet.BWP.set(BWP::T, m_jet.CSVv2 > m_jetCSVv2T);
+      context.jetsKinematics.push_back(m_jet.p4);
       
       selJets.push_back(m_jet);
-      
-      jetCounter++;
     }
   }
+}
+
+void TTAnalyzer::buildDiJets(const edm::Event& event, const ProducersManager& producers, EventContext& context) {
+
+  // All the lepton-jet distances of the event, used below instead of computing them for each combination
+  context.leptonJetDistances.compute(context.leptonsKinematics, context.jetsKinematics);
+
+  for(uint16_t jetCounter = 0; jetCounter < selJets.size(); jetCounter++){
+    Jet& m_jet = selJets[jetCounter];
 
-  // Sort the b-jets according to decreasing CSVv2 value
-  selBJets_DRCut_BWP_CSVv2Ordered = selBJets_DRCut_BWP_PtOrdered;
-  for(const LepID::LepID& id: LepID::it){
-    for(const LepIso::LepIso& iso: LepIso::it){
-      for(const BWP::BWP& wp: BWP::it){ 
-        uint16_t idx_comb_b = LepIDIsoJetBWP(id, iso, wp);
-        std::sort(selBJets_DRCut_BWP_CSVv2Ordered[idx_comb_b].begin(), selBJets_DRCut_BWP_CSVv2Ordered[idx_comb_b].end(), jetBTagDiscriminantSorter(jets, m_jetCSVv2Name, selJets));
+    // Save minimal DR(l,j) using selected leptons, for each Lepton ID/Iso
+    for(const WorkingPoints::Lepton& lepWP: m_workingPoints.leptons()){
+            
+      uint16_t idx_comb = LepIDIso(lepWP.id, lepWP.iso);
+        
+      for(const uint16_t& lepIdx: leptons_IDIso[idx_comb]){
+        float DR = context.leptonJetDistances.dR(lepIdx, jetCounter);
+        if( DR < m_jet.minDRjl_lepIDIso[idx_comb] )
+          m_jet.minDRjl_lepIDIso[idx_comb] = DR;
+      }
+        
+      // Save the indices to Jets passing the selected jetID and minDRjl > cut for this lepton ID/Iso
+      if( m_jet.minDRjl_lepIDIso[idx_comb] > m_jetDRleptonCut && m_jet.ID[m_jetIDSelector] ){
+        selJets_selID_DRCut[idx_comb].push_back(jetCounter);
+
+        // Out of these, save the indices for different b-tagging working points
+        for(const BWP::BWP& wp: lepWP.bwps){
+          uint16_t idx_comb_b = LepIDIsoJetBWP(lepWP.id, lepWP.iso, wp);
+          if ((m_jet.BWP[wp]) && (std::abs(context.jetsKinematics.eta[jetCounter]) < m_bJetEtaCut))
+            selBJets_DRCut_BWP_PtOrdered[idx_comb_b].push_back(jetCounter);
+        }
       }
     }
+    
+    if(m_jet.ID[m_jetIDSelector]) // Save the indices to Jets passing the selected jet ID
+      selJets_selID.push_back(jetCounter);
   }
+
+  // Order the b-jets according to decreasing CSVv2 value: the selected jets are sorted once, and the
+  // list of each combination is taken in that order (the same for the other objects below)
+  context.csvv2Keys.resize(selJets.size());
+  for(uint16_t j = 0; j < selJets.size(); j++)
+    context.csvv2Keys[j] = selJets[j].CSVv2;
+  sortByDecreasingKey(context.csvv2Keys, context.csvv2Order);
+  context.csvv2Orderer(context.csvv2Order, selBJets_DRCut_BWP_PtOrdered, selBJets_DRCut_BWP_CSVv2Ordered);
         
   ///////////////////////////
   //       DIJETS          //
@@ -327,56 +426,82 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
 
   // Next, construct DiJets out of selected jets with selected ID (not accounting for minDRjl here)
 
+  // Only the union of the leading jets in pt and of the leading jets in CSVv2 enter the combinatorics, kept in pt order
+  std::vector<uint16_t>& combinatoricsJets = context.combinatoricsJets;
+  if(m_maxJetsByPtForCombinatorics == 0 && m_maxJetsByCSVv2ForCombinatorics == 0){
+    combinatoricsJets = selJets_selID;
+  }else{
+    context.combinatoricsJetsSelected.assign(selJets.size(), 0);
+
+    for(uint16_t j = 0; j < selJets_selID.size() && j < m_maxJetsByPtForCombinatorics; j++)
+      context.combinatoricsJetsSelected[selJets_selID[j]] = 1;
+
+    // The selected jets are already in CSVv2 order (ties in pt order) in context.csvv2Order: take the leading ones passing the jet ID
+    uint16_t nJetsByCSVv2 = 0;
+    for(uint16_t j = 0; j < context.csvv2Order.size() && nJetsByCSVv2 < m_maxJetsByCSVv2ForCombinatorics; j++){
+      const uint16_t jidx = context.csvv2Order[j];
+      if(selJets[jidx].ID[m_jetIDSelector]){
+        context.combinatoricsJetsSelected[jidx] = 1;
+        nJetsByCSVv2++;
+      }
+    }
+
+    combinatoricsJets.clear();
+    for(const uint16_t& jidx: selJets_selID){
+      if(context.combinatoricsJetsSelected[jidx])
+        combinatoricsJets.push_back(jidx);
+    }
+
+    if(combinatoricsJets.size() < selJets_selID.size())
+      combinatoricsCaps |= CombinatoricsCap::Jets;
+  }
+
   uint16_t diJetCounter(0);
 
-  for(uint16_t j1 = 0; j1 < selJets_selID.size(); j1++){
-    for(uint16_t j2 = j1 + 1; j2 < selJets_selID.size(); j2++){
-      const uint16_t jidx1 = selJets_selID[j1];
+  for(uint16_t j1 = 0; j1 < combinatoricsJets.size(); j1++){
+    for(uint16_t j2 = j1 + 1; j2 < combinatoricsJets.size(); j2++){
+      const uint16_t jidx1 = combinatoricsJets[j1];
       const Jet& jet1 = selJets[jidx1];
-      const uint16_t jidx2 = selJets_selID[j2];
+      const uint16_t jidx2 = combinatoricsJets[j2];
       const Jet& jet2 = selJets[jidx2];
 
       DiJet m_diJet; 
-      m_diJet.p4 = jet1.p4 + jet2.p4;
+      m_diJet.p4 = Kinematics::sum(context.jetsKinematics, jidx1, context.jetsKinematics, jidx2);
       m_diJet.idxs = std::make_pair(jet1.idx, jet2.idx);
       m_diJet.jidxs = std::make_pair(jidx1, jidx2);
       
-      m_diJet.DR = VectorUtil::DeltaR(jet1.p4, jet2.p4);
-      m_diJet.DEta = DeltaEta(jet1.p4, jet2.p4);
-      m_diJet.DPhi = VectorUtil::DeltaPhi(jet1.p4, jet2.p4);
+      m_diJet.DR = Kinematics::DeltaR(context.jetsKinematics, jidx1, context.jetsKinematics, jidx2);
+      m_diJet.DEta = Kinematics::DeltaEta(context.jetsKinematics, jidx1, context.jetsKinematics, jidx2);
+      m_diJet.DPhi = Kinematics::DeltaPhi(context.jetsKinematics, jidx1, context.jetsKinematics, jidx2);
      
       for(const BWP::BWP& wp1: BWP::it){
         for(const BWP::BWP& wp2: BWP::it){
           uint16_t comb = JetJetBWP(wp1, wp2);
-          m_diJet.BWP[comb] = jet1.BWP[wp1] && jet2.BWP[wp2];
+          m_diJet.BWP.set(comb, jet1.BWP[wp1] && jet2.BWP[wp2]);
         }
       }
       
-      for(const LepID::LepID& id: LepID::it){
-        for(const LepIso::LepIso& iso: LepIso::it){
-          uint16_t combIDIso = LepIDIso(id, iso);
+      for(const WorkingPoints::Lepton& lepWP: m_workingPoints.leptons()){
+        uint16_t combIDIso = LepIDIso(lepWP.id, lepWP.iso);
 
-          m_diJet.minDRjl_lepIDIso[combIDIso] = std::min(jet1.minDRjl_lepIDIso[combIDIso], jet2.minDRjl_lepIDIso[combIDIso]);
-          
-          // Save the DiJets which have minDRjl>cut, for each leptonIDIso
-          if(m_diJet.minDRjl_lepIDIso[combIDIso] > m_jetDRleptonCut){
-            diJets_DRCut[combIDIso].push_back(diJetCounter);
-
-            // Out of these, save di-b-jets for each combination of b-tagging working points
-            for(const BWP::BWP& wp1: BWP::it){
-              for(const BWP::BWP& wp2: BWP::it){
-                uint16_t combB = JetJetBWP(wp1, wp2);
-                uint16_t combAll = LepIDIsoJetJetBWP(id, iso, wp1, wp2);
-                if ((m_diJet.BWP[combB])
-                        && (std::abs(jet1.p4.Eta()) < m_bJetEtaCut)
-                        && (std::abs(jet2.p4.Eta()) < m_bJetEtaCut))
-                  diBJets_DRCut_BWP_PtOrdered[combAll].push_back(diJetCounter);
-              }
-            }
+        m_diJet.minDRjl_lepIDIso[combIDIso] = std::min(jet1.minDRjl_lepIDIso[combIDIso], jet2.minDRjl_lepIDIso[combIDIso]);
           
+        // Save the DiJets which have minDRjl>cut, for each leptonIDIso
+        if(m_diJet.minDRjl_lepIDIso[combIDIso] > m_jetDRleptonCut){
+          diJets_DRCut[combIDIso].push_back(diJetCounter);
+
+          // Out of these, save di-b-jets for each combination of b-tagging working points
+          for(const auto& wps: lepWP.bwpPairs){
+            uint16_t combB = JetJetBWP(wps.first, wps.second);
+            uint16_t combAll = LepIDIsoJetJetBWP(lepWP.id, lepWP.iso, wps.first, wps.second);
+            if ((m_diJet.BWP[combB])
+                    && (std::abs(context.jetsKinematics.eta[jidx1]) < m_bJetEtaCut)
+                    && (std::abs(context.jetsKinematics.eta[jidx2]) < m_bJetEtaCut))
+              diBJets_DRCut_BWP_PtOrdered[combAll].push_back(diJetCounter);
           }
-        
+          
         }
+        
       }
       
       diJets.push_back(m_diJet); 
@@ -384,19 +509,16 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
     }
   }
 
-  // Order selected di-b-jets according to decreasing CSVv2 discriminant
-  diBJets_DRCut_BWP_CSVv2Ordered = diBJets_DRCut_BWP_PtOrdered;
-  for(const LepID::LepID& id: LepID::it){
-    for(const LepIso::LepIso& iso: LepIso::it){
-      for(const BWP::BWP& wp1: BWP::it){ 
-        for(const BWP::BWP& wp2: BWP::it){ 
-          uint16_t idx_comb_b = LepIDIsoJetJetBWP(id, iso, wp1, wp2);
-          std::sort(diBJets_DRCut_BWP_CSVv2Ordered[idx_comb_b].begin(), diBJets_DRCut_BWP_CSVv2Ordered[idx_comb_b].end(), diJetBTagDiscriminantSorter(jets, m_jetCSVv2Name, diJets));
-        }
-      }
-    }
-  }
-  
+  // Order selected di-b-jets according to decreasing CSVv2 discriminant (sum of the two jets)
+  context.diJetsCSVv2.resize(diJets.size());
+  for(uint16_t d = 0; d < diJets.size(); d++)
+    context.diJetsCSVv2[d] = selJets[diJets[d].jidxs.first].CSVv2 + selJets[diJets[d].jidxs.second].CSVv2;
+  sortByDecreasingKey(context.diJetsCSVv2, context.csvv2Order);
+  context.csvv2Orderer(context.csvv2Order, diBJets_DRCut_BWP_PtOrdered, diBJets_DRCut_BWP_CSVv2Ordered);
+}
+
+void TTAnalyzer::buildCandidates(const edm::Event& event, const ProducersManager& producers, EventContext& context) {
+
   ///////////////////////////
   //    EVENT VARIABLES    //
   ///////////////////////////
@@ -409,117 +531,76 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
 
   uint16_t diLepDiJetCounter(0);
 
-  for(uint16_t dilep = 0; dilep < diLeptons.size(); dilep++){
+  for(uint16_t dilep = 0; dilep < diLeptons.size() && !(combinatoricsCaps & CombinatoricsCap::DiLepDiJets); dilep++){
     const DiLepton& m_diLepton = diLeptons[dilep];
     
     for(uint16_t dijet = 0; dijet < diJets.size(); dijet++){
       const DiJet& m_diJet =  diJets[dijet];
+
+      if(m_maxDiLepDiJets > 0 && diLepDiJetCounter >= m_maxDiLepDiJets){
+        combinatoricsCaps |= CombinatoricsCap::DiLepDiJets;
+        break;
+      }
       
       DiLepDiJet m_diLepDiJet(m_diLepton, dilep, m_diJet, dijet);
 
-      m_diLepDiJet.minDRjl = std::min( {
-          (float) VectorUtil::DeltaR(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.first].p4),
-          (float) VectorUtil::DeltaR(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.second].p4),
-          (float) VectorUtil::DeltaR(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.first].p4),
-          (float) VectorUtil::DeltaR(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.second].p4)
-          } );
-      m_diLepDiJet.maxDRjl = std::max( {
-          (float) VectorUtil::DeltaR(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.first].p4),
-          (float) VectorUtil::DeltaR(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.second].p4),
-          (float) VectorUtil::DeltaR(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.first].p4),
-          (float) VectorUtil::DeltaR(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.second].p4)
-          } );
-      m_diLepDiJet.minDEtajl = std::min( {
-          DeltaEta(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.first].p4),
-          DeltaEta(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.second].p4),
-          DeltaEta(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.first].p4),
-          DeltaEta(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.second].p4)
-          } );
-      m_diLepDiJet.maxDEtajl = std::max( {
-          DeltaEta(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.first].p4),
-          DeltaEta(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.second].p4),
-          DeltaEta(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.first].p4),
-          DeltaEta(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.second].p4)
-          } );
-      m_diLepDiJet.minDPhijl = std::min( {
-          (float) VectorUtil::DeltaPhi(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.first].p4),
-          (float) VectorUtil::DeltaPhi(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.second].p4),
-          (float) VectorUtil::DeltaPhi(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.first].p4),
-          (float) VectorUtil::DeltaPhi(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.second].p4)
-          } );
-      m_diLepDiJet.maxDPhijl = std::max( {
-          (float) VectorUtil::DeltaPhi(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.first].p4),
-          (float) VectorUtil::DeltaPhi(leptons[m_diLepton.lidxs.first].p4, selJets[m_diJet.jidxs.second].p4),
-          (float) VectorUtil::DeltaPhi(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.first].p4),
-          (float) VectorUtil::DeltaPhi(leptons[m_diLepton.lidxs.second].p4, selJets[m_diJet.jidxs.second].p4)
-          } );
+      // The four (lepton, jet) pairs of the combination
+      const uint16_t ls[4] = { m_diLepton.lidxs.first, m_diLepton.lidxs.first, m_diLepton.lidxs.second, m_diLepton.lidxs.second };
+      const uint16_t js[4] = { m_diJet.jidxs.first, m_diJet.jidxs.second, m_diJet.jidxs.first, m_diJet.jidxs.second };
+      float DRjl[4], DEtajl[4], DPhijl[4];
+      for(uint8_t k = 0; k < 4; k++){
+        const size_t entry = context.leptonJetDistances.index(ls[k], js[k]);
+        DRjl[k] = context.leptonJetDistances.DR[entry];
+        DEtajl[k] = context.leptonJetDistances.DEta[entry];
+        DPhijl[k] = context.leptonJetDistances.DPhi[entry];
+      }
+
+      m_diLepDiJet.minDRjl = std::min( { DRjl[0], DRjl[1], DRjl[2], DRjl[3] } );
+      m_diLepDiJet.maxDRjl = std::max( { DRjl[0], DRjl[1], DRjl[2], DRjl[3] } );
+      m_diLepDiJet.minDEtajl = std::min( { DEtajl[0], DEtajl[1], DEtajl[2], DEtajl[3] } );
+      m_diLepDiJet.maxDEtajl = std::max( { DEtajl[0], DEtajl[1], DEtajl[2], DEtajl[3] } );
+      m_diLepDiJet.minDPhijl = std::min( { DPhijl[0], DPhijl[1], DPhijl[2], DPhijl[3] } );
+      m_diLepDiJet.maxDPhijl = std::max( { DPhijl[0], DPhijl[1], DPhijl[2], DPhijl[3] } );
 
       diLepDiJets.push_back(m_diLepDiJet);
 
-      for(const LepID::LepID& id1: LepID::it){
-        for(const LepID::LepID& id2: LepID::it){
-          for(const LepIso::LepIso& iso1: LepIso::it){
-            for(const LepIso::LepIso& iso2: LepIso::it){
+      for(const WorkingPoints::DiLepton& wp: m_workingPoints.diLeptons()){
               
-              uint16_t combID = LepLepID(id1, id2);
-              LepID::LepID minID = std::min(id1, id2);
+        uint16_t combID = LepLepID(wp.id1, wp.id2);
               
-              uint16_t combIso = LepLepIso(iso1, iso2);
-              LepIso::LepIso minIso = std::min(iso1, iso2);
+        uint16_t combIso = LepLepIso(wp.iso1, wp.iso2);
 
-              uint16_t minCombIDIso = LepIDIso(minID, minIso);
-              uint16_t diLepCombIDIso = LepLepIDIso(id1, iso1, id2, iso2);
+        uint16_t diLepCombIDIso = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+        uint16_t minCombIDIso = LepLepIDIsoLoosest(diLepCombIDIso);
              
-              // Store objects for each combined lepton ID/Iso, with jets having minDRjl>cut for leptons corresponding to the loosest combination of the aforementioned ID/Iso
-              if(m_diLepton.ID[combID] && m_diLepton.iso[combIso] && m_diJet.minDRjl_lepIDIso[minCombIDIso] > m_jetDRleptonCut){
-                diLepDiJets_DRCut[diLepCombIDIso].push_back(diLepDiJetCounter);
+        // Store objects for each combined lepton ID/Iso, with jets having minDRjl>cut for leptons corresponding to the loosest combination of the aforementioned ID/Iso
+        if(m_diLepton.ID[combID] && m_diLepton.iso[combIso] && m_diJet.minDRjl_lepIDIso[minCombIDIso] > m_jetDRleptonCut){
+          diLepDiJets_DRCut[diLepCombIDIso].push_back(diLepDiJetCounter);
                 
-                // Out of these, store combinations of b-tagging working points
-                for(const BWP::BWP& wp1: BWP::it){
-                  for(const BWP::BWP& wp2: BWP::it){
-                    uint16_t combB = JetJetBWP(wp1, wp2);
-                    uint16_t combAll = LepLepIDIsoJetJetBWP(id1, iso1, id2, iso2, wp1, wp2);
-                    if ((m_diJet.BWP[combB])
-                            && (std::abs(jets.p4[m_diJet.idxs.first].Eta()) < m_bJetEtaCut)
-                            && (std::abs(jets.p4[m_diJet.idxs.second].Eta()) < m_bJetEtaCut))
-                      diLepDiBJets_DRCut_BWP_PtOrdered[combAll].push_back(diLepDiJetCounter);
-                  }
-                } // end b-jet loops
-
-              } // end minDRjl>cut
+          // Out of these, store combinations of b-tagging working points
+          for(const auto& wps: wp.bwpPairs){
+            uint16_t combB = JetJetBWP(wps.first, wps.second);
+            uint16_t combAll = LepLepIDIsoJetJetBWP(wp.id1, wp.iso1, wp.id2, wp.iso2, wps.first, wps.second);
+            if ((m_diJet.BWP[combB])
+                    && (std::abs(context.jetsKinematics.eta[m_diJet.jidxs.first]) < m_bJetEtaCut)
+                    && (std::abs(context.jetsKinematics.eta[m_diJet.jidxs.second]) < m_bJetEtaCut))
+              diLepDiBJets_DRCut_BWP_PtOrdered[combAll].push_back(diLepDiJetCounter);
+          } // end b-jet loop
 
-            }
-          } // end lepton iso loops
-        }
-      } // end lepton ID loops
+        } // end minDRjl>cut
+
+      } // end lepton ID/Iso loop
 
       diLepDiJetCounter++;
     } // end dijet loop
   } // end dilepton loop
 
-  // Order selected di-lepton-di-b-jets according to decreasing CSVv2 discriminant
-  diLepDiBJets_DRCut_BWP_CSVv2Ordered = diLepDiBJets_DRCut_BWP_PtOrdered;
-  
-  for(const LepID::LepID& id1: LepID::it){
-    for(const LepID::LepID& id2: LepID::it){
-      
-      for(const LepIso::LepIso& iso1: LepIso::it){
-        for(const LepIso::LepIso& iso2: LepIso::it){
-          
-          for(const BWP::BWP& wp1: BWP::it){ 
-            for(const BWP::BWP& wp2: BWP::it){ 
-              
-              uint16_t idx_comb_all = LepLepIDIsoJetJetBWP(id1, iso1, id2, iso2, wp1, wp2);
-              std::sort(diLepDiBJets_DRCut_BWP_CSVv2Ordered[idx_comb_all].begin(), diLepDiBJets_DRCut_BWP_CSVv2Ordered[idx_comb_all].end(), diJetBTagDiscriminantSorter(jets, m_jetCSVv2Name, diLepDiJets));
-            
-            }
-          }
-        
-        }
-      }
-    
-    }
-  }
+  // Order selected di-lepton-di-b-jets according to decreasing CSVv2 discriminant of their DiJet
+  context.csvv2Keys.resize(diLepDiJets.size());
+  for(uint16_t d = 0; d < diLepDiJets.size(); d++)
+    context.csvv2Keys[d] = context.diJetsCSVv2[diLepDiJets[d].diJetIdx];
+  sortByDecreasingKey(context.csvv2Keys, context.csvv2Order);
+  context.csvv2Orderer(context.csvv2Order, diLepDiBJets_DRCut_BWP_PtOrdered, diLepDiBJets_DRCut_BWP_CSVv2Ordered);
       
   // leptons-(b-)jets-MET
 
@@ -528,127 +609,100 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
   #endif
 
   const METProducer &met = producers.get<METProducer>(m_met_producer);
+  context.metKinematics.clear();
+  context.metKinematics.push_back(met.p4);
+  context.leptonMetDistances.compute(context.leptonsKinematics, context.metKinematics);
+  context.jetMetDistances.compute(context.jetsKinematics, context.metKinematics);
   
-  for(uint16_t i = 0; i < diLepDiJets.size(); i++){
+  // DiLepDiJetMet candidates are only built for the DiLepDiJets landing in at least one combination of working points:
+  // diLepDiJetsMet is therefore not parallel to diLepDiJets, use diLepDiJetIdx to go from one to the other.
+  auto buildDiLepDiJetMet = [&](const uint16_t i) -> uint16_t {
     // Using regular MET
     DiLepDiJetMet m_diLepDiJetMet(diLepDiJets[i], i, met.p4);
     
-    m_diLepDiJetMet.minDR_l_Met = std::min(
-        (float) VectorUtil::DeltaR(leptons[m_diLepDiJetMet.diLepton->lidxs.first].p4, met.p4),
-        (float) VectorUtil::DeltaR(leptons[m_diLepDiJetMet.diLepton->lidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.maxDR_l_Met = std::max(
-        (float) VectorUtil::DeltaR(leptons[m_diLepDiJetMet.diLepton->lidxs.first].p4, met.p4),
-        (float) VectorUtil::DeltaR(leptons[m_diLepDiJetMet.diLepton->lidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.minDEta_l_Met = std::min(
-        DeltaEta(leptons[m_diLepDiJetMet.diLepton->lidxs.first].p4, met.p4),
-        DeltaEta(leptons[m_diLepDiJetMet.diLepton->lidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.maxDEta_l_Met = std::max(
-        DeltaEta(leptons[m_diLepDiJetMet.diLepton->lidxs.first].p4, met.p4),
-        DeltaEta(leptons[m_diLepDiJetMet.diLepton->lidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.minDPhi_l_Met = std::min(
-        (float) VectorUtil::DeltaPhi(leptons[m_diLepDiJetMet.diLepton->lidxs.first].p4, met.p4),
-        (float) VectorUtil::DeltaPhi(leptons[m_diLepDiJetMet.diLepton->lidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.maxDPhi_l_Met = std::max(
-        (float) VectorUtil::DeltaPhi(leptons[m_diLepDiJetMet.diLepton->lidxs.first].p4, met.p4),
-        (float) VectorUtil::DeltaPhi(leptons[m_diLepDiJetMet.diLepton->lidxs.second].p4, met.p4)
-        );
-
-    m_diLepDiJetMet.minDR_j_Met = std::min(
-        (float) VectorUtil::DeltaR(selJets[m_diLepDiJetMet.diJet->jidxs.first].p4, met.p4),
-        (float) VectorUtil::DeltaR(selJets[m_diLepDiJetMet.diJet->jidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.maxDR_j_Met = std::max(
-        (float) VectorUtil::DeltaR(selJets[m_diLepDiJetMet.diJet->jidxs.first].p4, met.p4),
-        (float) VectorUtil::DeltaR(selJets[m_diLepDiJetMet.diJet->jidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.minDEta_j_Met = std::min(
-        DeltaEta(selJets[m_diLepDiJetMet.diJet->jidxs.first].p4, met.p4),
-        DeltaEta(selJets[m_diLepDiJetMet.diJet->jidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.maxDEta_j_Met = std::max(
-        DeltaEta(selJets[m_diLepDiJetMet.diJet->jidxs.first].p4, met.p4),
-        DeltaEta(selJets[m_diLepDiJetMet.diJet->jidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.minDPhi_j_Met = std::min(
-        (float) VectorUtil::DeltaPhi(selJets[m_diLepDiJetMet.diJet->jidxs.first].p4, met.p4),
-        (float) VectorUtil::DeltaPhi(selJets[m_diLepDiJetMet.diJet->jidxs.second].p4, met.p4)
-        );
-    m_diLepDiJetMet.maxDPhi_j_Met = std::max(
-        (float) VectorUtil::DeltaPhi(selJets[m_diLepDiJetMet.diJet->jidxs.first].p4, met.p4),
-        (float) VectorUtil::DeltaPhi(selJets[m_diLepDiJetMet.diJet->jidxs.second].p4, met.p4)
-        );
+    const uint16_t l1 = m_diLepDiJetMet.diLepton->lidxs.first, l2 = m_diLepDiJetMet.diLepton->lidxs.second;
+    const uint16_t j1 = m_diLepDiJetMet.diJet->jidxs.first, j2 = m_diLepDiJetMet.diJet->jidxs.second;
+
+    const float DR_l1_Met = context.leptonMetDistances.DR[l1];
+    const float DR_l2_Met = context.leptonMetDistances.DR[l2];
+    const float DEta_l1_Met = context.leptonMetDistances.DEta[l1];
+    const float DEta_l2_Met = context.leptonMetDistances.DEta[l2];
+    const float DPhi_l1_Met = context.leptonMetDistances.DPhi[l1];
+    const float DPhi_l2_Met = context.leptonMetDistances.DPhi[l2];
+
+    m_diLepDiJetMet.minDR_l_Met = std::min(DR_l1_Met, DR_l2_Met);
+    m_diLepDiJetMet.maxDR_l_Met = std::max(DR_l1_Met, DR_l2_Met);
+    m_diLepDiJetMet.minDEta_l_Met = std::min(DEta_l1_Met, DEta_l2_Met);
+    m_diLepDiJetMet.maxDEta_l_Met = std::max(DEta_l1_Met, DEta_l2_Met);
+    m_diLepDiJetMet.minDPhi_l_Met = std::min(DPhi_l1_Met, DPhi_l2_Met);
+    m_diLepDiJetMet.maxDPhi_l_Met = std::max(DPhi_l1_Met, DPhi_l2_Met);
+
+    const float DR_j1_Met = context.jetMetDistances.DR[j1];
+    const float DR_j2_Met = context.jetMetDistances.DR[j2];
+    const float DEta_j1_Met = context.jetMetDistances.DEta[j1];
+    const float DEta_j2_Met = context.jetMetDistances.DEta[j2];
+    const float DPhi_j1_Met = context.jetMetDistances.DPhi[j1];
+    const float DPhi_j2_Met = context.jetMetDistances.DPhi[j2];
+
+    m_diLepDiJetMet.minDR_j_Met = std::min(DR_j1_Met, DR_j2_Met);
+    m_diLepDiJetMet.maxDR_j_Met = std::max(DR_j1_Met, DR_j2_Met);
+    m_diLepDiJetMet.minDEta_j_Met = std::min(DEta_j1_Met, DEta_j2_Met);
+    m_diLepDiJetMet.maxDEta_j_Met = std::max(DEta_j1_Met, DEta_j2_Met);
+    m_diLepDiJetMet.minDPhi_j_Met = std::min(DPhi_j1_Met, DPhi_j2_Met);
+    m_diLepDiJetMet.maxDPhi_j_Met = std::max(DPhi_j1_Met, DPhi_j2_Met);
 
     diLepDiJetsMet.push_back(m_diLepDiJetMet);
+    return diLepDiJetsMet.size() - 1;
+  };
+
+  for(uint16_t i = 0; i < diLepDiJets.size(); i++){
+    const DiLepDiJet& m_diLepDiJet = diLepDiJets[i];
+    const uint16_t j1 = m_diLepDiJet.diJet->jidxs.first, j2 = m_diLepDiJet.diJet->jidxs.second;
 
-    for(const LepID::LepID& id1: LepID::it){
-      for(const LepID::LepID& id2: LepID::it){
-        for(const LepIso::LepIso& iso1: LepIso::it){
-          for(const LepIso::LepIso& iso2: LepIso::it){
+    // Index of this candidate in diLepDiJetsMet, once built
+    int32_t metIdx = -1;
+
+    for(const WorkingPoints::DiLepton& wp: m_workingPoints.diLeptons()){
             
-            uint16_t combID = LepLepID(id1, id2);
-            LepID::LepID minID = std::min(id1, id2);
+      uint16_t combID = LepLepID(wp.id1, wp.id2);
             
-            uint16_t combIso = LepLepIso(iso1, iso2);
-            LepIso::LepIso minIso = std::min(iso1, iso2);
+      uint16_t combIso = LepLepIso(wp.iso1, wp.iso2);
 
-            uint16_t minCombIDIso = LepIDIso(minID, minIso);
-            uint16_t diLepCombIDIso = LepLepIDIso(id1, iso1, id2, iso2);
+      uint16_t diLepCombIDIso = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+      uint16_t minCombIDIso = LepLepIDIsoLoosest(diLepCombIDIso);
            
-            // Store objects for each combined lepton ID/Iso, with jets having minDRjl>cut for leptons corresponding to the loosest combination of the aforementioned ID/Iso
+      // Store objects for each combined lepton ID/Iso, with jets having minDRjl>cut for leptons corresponding to the loosest combination of the aforementioned ID/Iso
             
-            // First regular MET
-            if(m_diLepDiJetMet.diLepton->ID[combID] && m_diLepDiJetMet.diLepton->iso[combIso] && m_diLepDiJetMet.diJet->minDRjl_lepIDIso[minCombIDIso] > m_jetDRleptonCut){
-              diLepDiJetsMet_DRCut[diLepCombIDIso].push_back(i);
-              
-              // Out of these, store combinations of b-tagging working points
-              for(const BWP::BWP& wp1: BWP::it){
-                for(const BWP::BWP& wp2: BWP::it){
-                  uint16_t combB = JetJetBWP(wp1, wp2);
-                  uint16_t combAll = LepLepIDIsoJetJetBWP(id1, iso1, id2, iso2, wp1, wp2);
-                  if ((m_diLepDiJetMet.diJet->BWP[combB])
-                          && (std::abs(jets.p4[m_diLepDiJetMet.diJet->idxs.first].Eta()) < m_bJetEtaCut)
-                          && (std::abs(jets.p4[m_diLepDiJetMet.diJet->idxs.second].Eta()) < m_bJetEtaCut))
-                    diLepDiBJetsMet_DRCut_BWP_PtOrdered[combAll].push_back(i);
-                }
-              } // end b-jet loops
-
-            } // end minDRjl>cut
+      // First regular MET
+      if(m_diLepDiJet.diLepton->ID[combID] && m_diLepDiJet.diLepton->iso[combIso] && m_diLepDiJet.diJet->minDRjl_lepIDIso[minCombIDIso] > m_jetDRleptonCut){
+        if(metIdx < 0)
+          metIdx = buildDiLepDiJetMet(i);
 
-          }
-        } // end lepton iso loops
-      }
-    } // end lepton ID loops
+        diLepDiJetsMet_DRCut[diLepCombIDIso].push_back(metIdx);
+              
+        // Out of these, store combinations of b-tagging working points
+        for(const auto& wps: wp.bwpPairs){
+          uint16_t combB = JetJetBWP(wps.first, wps.second);
+          uint16_t combAll = LepLepIDIsoJetJetBWP(wp.id1, wp.iso1, wp.id2, wp.iso2, wps.first, wps.second);
+          if ((m_diLepDiJet.diJet->BWP[combB])
+                  && (std::abs(context.jetsKinematics.eta[j1]) < m_bJetEtaCut)
+                  && (std::abs(context.jetsKinematics.eta[j2]) < m_bJetEtaCut))
+            diLepDiBJetsMet_DRCut_BWP_PtOrdered[combAll].push_back(metIdx);
+        } // end b-jet loop
+
+      } // end minDRjl>cut
+
+    } // end lepton ID/Iso loop
      
   } // end diLepDiJet loop
   
   // Store objects according to CSVv2
   // First regular MET
-  diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered = diLepDiBJetsMet_DRCut_BWP_PtOrdered; 
-  for(const LepID::LepID& id1: LepID::it){
-    for(const LepID::LepID& id2: LepID::it){
-      
-      for(const LepIso::LepIso& iso1: LepIso::it){
-        for(const LepIso::LepIso& iso2: LepIso::it){
-          
-          for(const BWP::BWP& wp1: BWP::it){ 
-            for(const BWP::BWP& wp2: BWP::it){ 
-              
-              uint16_t idx_comb_all = LepLepIDIsoJetJetBWP(id1, iso1, id2, iso2, wp1, wp2);
-              std::sort(diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered[idx_comb_all].begin(), diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered[idx_comb_all].end(), diJetBTagDiscriminantSorter(jets, m_jetCSVv2Name, diLepDiJetsMet));
-            
-            }
-          }
-        
-        }
-      }
-    
-    }
-  }
+  context.csvv2Keys.resize(diLepDiJetsMet.size());
+  for(uint16_t d = 0; d < diLepDiJetsMet.size(); d++)
+    context.csvv2Keys[d] = context.diJetsCSVv2[diLepDiJetsMet[d].diJetIdx];
+  sortByDecreasingKey(context.csvv2Keys, context.csvv2Order);
+  context.csvv2Orderer(context.csvv2Order, diLepDiBJetsMet_DRCut_BWP_PtOrdered, diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered);
   
   ///////////////////////////
   //         MTT           //
@@ -662,96 +716,259 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
   std::cout << "Reconstructing ttbar system" << std::endl;
 #endif
 
-  for(const LepID::LepID& id1: LepID::it){
-    for(const LepID::LepID& id2: LepID::it){
-      
-      for(const LepIso::LepIso& iso1: LepIso::it){
-        for(const LepIso::LepIso& iso2: LepIso::it){
-          
-          for(const BWP::BWP& wp1: BWP::it){ 
-            for(const BWP::BWP& wp2: BWP::it){ 
-              
-              uint16_t idx_comb_all = LepLepIDIsoJetJetBWP(id1, iso1, id2, iso2, wp1, wp2);
+  NeutrinosSolver& neutrinosSolver = context.neutrinosSolvers.get(event.isRealData());
+
+  // The same DiLepDiJetMet candidate appears in many combinations of working points (looser working points being
+  // supersets of tighter ones). Each distinct candidate is therefore solved only once, and its solutions are cached
+  // for the whole event: mtt_candidate_slot maps a candidate index to its position in the cache, or -1 if not seen yet.
+  // All the buffers below live in context.mtt, and are only reset between events: once their capacity fits the busiest events,
+  // they do not allocate anymore.
+  std::vector<int32_t>& mtt_candidate_slot = context.mtt.candidate_slot;
+  mtt_candidate_slot.assign(diLepDiJetsMet.size(), -1);
+  std::vector<uint16_t>& mtt_candidates = context.mtt.candidates;
+  mtt_candidates.clear();
+
+  // First gather the inputs of all the distinct candidates into structure-of-arrays form, to solve all of them in one batched call.
+  // Each candidate is solved twice: once for each assignment of the b-jets to the leptons.
+  // The part of the coefficients depending on only one (lepton, b-jet) pair is computed once for the event, and shared
+  // by both assignments and by all the candidates made of the same objects: mtt_pair_slot maps
+  // (lepton index * number of jets + jet index) to the position of the pair in mtt_pairs, or -1 if not seen yet.
+
+  const NeutrinosSolver::Statistics mtt_statistics_before = neutrinosSolver.statistics();
+
+  std::vector<int32_t>& mtt_pair_slot = context.mtt.pair_slot;
+  mtt_pair_slot.assign(leptons.size() * selJets.size(), -1);
+  std::vector<NeutrinosSolver::PairCoefficients>& mtt_pairs = context.mtt.pairs;
+  mtt_pairs.clear();
+  std::vector<uint32_t>& mtt_pairs1 = context.mtt.pairs1;
+  std::vector<uint32_t>& mtt_pairs2 = context.mtt.pairs2;
+  mtt_pairs1.clear();
+  mtt_pairs2.clear();
+  NeutrinosSolver::P4Buffer& mtt_met_p4 = context.mtt.met_p4;
+  mtt_met_p4.clear();
+  const NeutrinosSolver::LorentzVector met_p4 = context.metKinematics.solverP4(0);
+
+  auto mtt_pair = [&](const uint16_t lepton, const uint16_t jet) -> uint32_t {
+    int32_t& slot = mtt_pair_slot[lepton * selJets.size() + jet];
+    if (slot < 0) {
+      slot = mtt_pairs.size();
+      mtt_pairs.emplace_back();
+      neutrinosSolver.computePairCoefficients(context.leptonsKinematics.solverP4(lepton), context.jetsKinematics.solverP4(jet), mtt_pairs.back());
+    }
+    return slot;
+  };
 
-              std::vector<std::vector<TTAnalysis::TTBar>> ttbar_event_sols;
+  for(const WorkingPoints::DiLepton& wp: m_workingPoints.diLeptons()){
+    for(const auto& wps: wp.bwpPairs){
 
-              for (const auto& idx: diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered[idx_comb_all]) {
+      uint16_t idx_comb_all = LepLepIDIsoJetJetBWP(wp.id1, wp.iso1, wp.id2, wp.iso2, wps.first, wps.second);
 
-                using namespace TTAnalysis;
-              
-                NeutrinosSolver::LorentzVector lepton1_p4(leptons[diLepDiJetsMet[idx].diLepton->lidxs.first].p4);
-                NeutrinosSolver::LorentzVector lepton2_p4(leptons[diLepDiJetsMet[idx].diLepton->lidxs.second].p4);
-                NeutrinosSolver::LorentzVector bjet1_p4(selJets[diLepDiJetsMet[idx].diJet->jidxs.first].p4);
-                NeutrinosSolver::LorentzVector bjet2_p4(selJets[diLepDiJetsMet[idx].diJet->jidxs.second].p4);
+      for (const auto& idx: diLepDiBJetsMet_DRCut_BWP_CSVv2Ordered[idx_comb_all]) {
 
-                NeutrinosSolver::LorentzVector met_p4(met.p4);
+        if (mtt_candidate_slot[idx] >= 0)
+          continue;
 
-#if TT_MTT_DEBUG
-                std::cout << "Objects:" << std::endl;
-                std::cout << "\t Lepton 1: " << lepton1_p4 << std::endl;
-                std::cout << "\t b-jet 1: " << bjet1_p4 << std::endl;
-                std::cout << "\t Lepton 2: " << bjet2_p4 << std::endl;
-                std::cout << "\t b-jet 2: " << bjet2_p4 << std::endl;
-#endif
+        mtt_candidate_slot[idx] = mtt_candidates.size();
+        mtt_candidates.push_back(idx);
 
-                auto sols = m_neutrinos_solver->getNeutrinos(lepton1_p4, lepton2_p4, bjet1_p4, bjet2_p4, met_p4);
+        const uint16_t lepton1 = diLepDiJetsMet[idx].diLepton->lidxs.first;
+        const uint16_t lepton2 = diLepDiJetsMet[idx].diLepton->lidxs.second;
+        const uint16_t bjet1 = diLepDiJetsMet[idx].diJet->jidxs.first;
+        const uint16_t bjet2 = diLepDiJetsMet[idx].diJet->jidxs.second;
 
-#if TT_MTT_DEBUG
-                std::cout << "Got " << sols.size() << " solutions for neutrinos" << std::endl;
-#endif
+        for (uint8_t swap = 0; swap < 2; swap++) {
+          mtt_pairs1.push_back(mtt_pair(lepton1, swap ? bjet2 : bjet1));
+          mtt_pairs2.push_back(mtt_pair(lepton2, swap ? bjet1 : bjet2));
+          mtt_met_p4.push_back(met_p4);
+        }
+      }
+    }
+  }
 
-                std::vector<TTBar> ttbar_sols;
-                for (auto& sol: sols) {
-#if TT_MTT_DEBUG
-                    std::cout << "\t Neutrino 1: " << sol.first << std::endl;
-                    std::cout << "\t Neutrino 2: " << sol.second << std::endl;
-#endif
-                    ttbar_sols.push_back(TTBar(idx, myLorentzVector(lepton1_p4 + bjet1_p4 + sol.first), myLorentzVector(lepton2_p4 + bjet2_p4 + sol.second)));
-#if TT_MTT_DEBUG
-                    std::cout << "mtt: " << ttbar_sols.back().p4.M() << std::endl;
-#endif
-                }
+  const size_t mtt_n_inputs = mtt_pairs1.size();
 
-#if TT_MTT_DEBUG
-                std::cout << "Swapping b-jets and recomputing solutions" << std::endl;
-#endif
+  NeutrinosSolver::P4Buffer& mtt_neutrino1_p4 = context.mtt.neutrino1_p4;
+  NeutrinosSolver::P4Buffer& mtt_neutrino2_p4 = context.mtt.neutrino2_p4;
+  mtt_neutrino1_p4.resize(NeutrinosSolver::maxSolutions * mtt_n_inputs);
+  mtt_neutrino2_p4.resize(NeutrinosSolver::maxSolutions * mtt_n_inputs);
+  std::vector<uint8_t>& mtt_n_solutions = context.mtt.n_solutions;
+  mtt_n_solutions.resize(mtt_n_inputs);
+
+  // The solutions of each candidate are cleared rather than destroyed, to keep the capacity of the inner vectors
+  std::vector<std::vector<TTBar>>& mtt_solutions = context.mtt.solutions;
+  if (mtt_solutions.size() < mtt_candidates.size())
+    mtt_solutions.resize(mtt_candidates.size());
+  for (size_t slot = 0; slot < mtt_candidates.size(); slot++)
+    mtt_solutions[slot].clear();
+
+  // Sampling mode, for the inputs without any solution: the random stream of each input only depends on the event and the candidate,
+  // identified by its DiLepDiJet index (stable whatever the DiLepDiJetMet candidates built)
+  const NeutrinosSolver::Resolutions mtt_resolutions = { m_neutrinosSolverJetResolution, m_neutrinosSolverMetResolution };
+  const uint64_t mtt_event_seed = combineSeeds(combineSeeds(event.id().run(), event.id().luminosityBlock()), event.id().event());
+
+  // Then solve the candidates of slots [begin, end), and build their ttbar candidates out of the solutions, in the same order
+  // as the inputs. Candidate `slot` only reads inputs 2*slot and 2*slot + 1 and only writes mtt_solutions[slot]: disjoint ranges
+  // of slots can be processed concurrently, each with its own solver, and give the same results as a single serial call.
+  auto mtt_solve = [&](const size_t begin, const size_t end, NeutrinosSolver& solver, NeutrinosSolver::Samples& mtt_samples) {
+
+    const size_t first_input = 2 * begin;
+    const size_t solution_offset = NeutrinosSolver::maxSolutions * first_input;
+    const NeutrinosSolver::ConstP4Array met_view = mtt_met_p4.view();
+    const NeutrinosSolver::P4Array neutrino1_view = mtt_neutrino1_p4.mutableView();
+    const NeutrinosSolver::P4Array neutrino2_view = mtt_neutrino2_p4.mutableView();
+
+    solver.getNeutrinos(2 * (end - begin), mtt_pairs.data(), mtt_pairs1.data() + first_input, mtt_pairs2.data() + first_input,
+        { met_view.px + first_input, met_view.py + first_input, met_view.pz + first_input, met_view.E + first_input },
+        { neutrino1_view.px + solution_offset, neutrino1_view.py + solution_offset, neutrino1_view.pz + solution_offset, neutrino1_view.E + solution_offset },
+        { neutrino2_view.px + solution_offset, neutrino2_view.py + solution_offset, neutrino2_view.pz + solution_offset, neutrino2_view.E + solution_offset },
+        mtt_n_solutions.data() + first_input);
+
+    size_t mtt_input = first_input;
+
+    for (size_t slot = begin; slot < end; slot++) {
+
+      const uint16_t idx = mtt_candidates[slot];
+      std::vector<TTBar>& ttbar_sols = mtt_solutions[slot];
+
+      // First the nominal assignment, then with swapped b-jets
+      for (uint8_t swap = 0; swap < 2; swap++, mtt_input++) {
 
-                // Swap b-jets
-                std::swap(bjet1_p4, bjet2_p4);
-                sols = m_neutrinos_solver->getNeutrinos(lepton1_p4, lepton2_p4, bjet1_p4, bjet2_p4, met_p4);
+        const NeutrinosSolver::PairCoefficients& pair1 = mtt_pairs[mtt_pairs1[mtt_input]];
+        const NeutrinosSolver::PairCoefficients& pair2 = mtt_pairs[mtt_pairs2[mtt_input]];
+
+        const NeutrinosSolver::LorentzVector lepton1_p4 = pair1.lepton_p4();
+        const NeutrinosSolver::LorentzVector lepton2_p4 = pair2.lepton_p4();
+        const NeutrinosSolver::LorentzVector bjet1_p4 = pair1.bjet_p4();
+        const NeutrinosSolver::LorentzVector bjet2_p4 = pair2.bjet_p4();
 
 #if TT_MTT_DEBUG
-                std::cout << "Got " << sols.size() << " solutions for neutrinos" << std::endl;
+        std::cout << "Objects:" << std::endl;
+        std::cout << "\t Lepton 1: " << lepton1_p4 << std::endl;
+        std::cout << "\t b-jet 1: " << bjet1_p4 << std::endl;
+        std::cout << "\t Lepton 2: " << lepton2_p4 << std::endl;
+        std::cout << "\t b-jet 2: " << bjet2_p4 << std::endl;
+        std::cout << "Got " << (int) mtt_n_solutions[mtt_input] << " solutions for neutrinos" << std::endl;
 #endif
 
-                for (auto& sol: sols) {
+        for (uint8_t sol = 0; sol < mtt_n_solutions[mtt_input]; sol++) {
+          const size_t sol_idx = NeutrinosSolver::maxSolutions * mtt_input + sol;
+          const NeutrinosSolver::LorentzVector neutrino1_p4 = mtt_neutrino1_p4.at(sol_idx);
+          const NeutrinosSolver::LorentzVector neutrino2_p4 = mtt_neutrino2_p4.at(sol_idx);
 #if TT_MTT_DEBUG
-                    std::cout << "\t Neutrino 1: " << sol.first << std::endl;
-                    std::cout << "\t Neutrino 2: " << sol.second << std::endl;
+          std::cout << "\t Neutrino 1: " << neutrino1_p4 << std::endl;
+          std::cout << "\t Neutrino 2: " << neutrino2_p4 << std::endl;
 #endif
-                    ttbar_sols.push_back(TTBar(idx, myLorentzVector(lepton1_p4 + bjet1_p4 + sol.first), myLorentzVector(lepton2_p4 + bjet2_p4 + sol.second)));
+          ttbar_sols.push_back(TTBar(idx, myLorentzVector(lepton1_p4 + bjet1_p4 + neutrino1_p4), myLorentzVector(lepton2_p4 + bjet2_p4 + neutrino2_p4)));
 #if TT_MTT_DEBUG
-                    std::cout << "mtt: " << ttbar_sols.back().p4.M() << std::endl;
+          std::cout << "mtt: " << ttbar_sols.back().p4.M() << std::endl;
 #endif
-                }
+        }
 
-                // Sort solutions by increasing order of mtt
-                std::sort(ttbar_sols.begin(), ttbar_sols.end(), [](const TTBar& a, const TTBar& b) {
-                            return a.p4.M() < b.p4.M();
-                        });
+        if (mtt_n_solutions[mtt_input] == 0 && m_neutrinosSolverSmearingSamples > 0) {
+          // No solution for the nominal inputs: solve for smeared variations of the b-jets and MET, keep for each variation
+          // the solution with the lowest mtt, and average the top quarks over the variations having a solution
+          solver.getSmearedNeutrinos(lepton1_p4, lepton2_p4, bjet1_p4, bjet2_p4, mtt_met_p4.at(mtt_input),
+              m_neutrinosSolverSmearingSamples, mtt_resolutions, combineSeeds(combineSeeds(mtt_event_seed, diLepDiJetsMet[idx].diLepDiJetIdx), swap), mtt_samples);
 
+          NeutrinosSolver::LorentzVector top1_p4, top2_p4;
+          size_t n_samples_with_solution = 0;
 
-                ttbar_event_sols.push_back(ttbar_sols);
-              }
+          for (size_t sample = 0; sample < mtt_samples.size(); sample++) {
+            if (mtt_samples.n_solutions[sample] == 0)
+              continue;
+
+            const NeutrinosSolver::LorentzVector smeared_bjet1_p4 = mtt_samples.bjet1_p4.at(sample);
+            const NeutrinosSolver::LorentzVector smeared_bjet2_p4 = mtt_samples.bjet2_p4.at(sample);
+
+            NeutrinosSolver::LorentzVector best_top1_p4, best_top2_p4;
+            double best_mtt = std::numeric_limits<double>::max();
+
+            for (uint8_t sol = 0; sol < mtt_samples.n_solutions[sample]; sol++) {
+              const size_t sol_idx = NeutrinosSolver::maxSolutions * sample + sol;
+              const NeutrinosSolver::LorentzVector sol_top1_p4 = lepton1_p4 + smeared_bjet1_p4 + mtt_samples.neutrino1_p4.at(sol_idx);
+              const NeutrinosSolver::LorentzVector sol_top2_p4 = lepton2_p4 + smeared_bjet2_p4 + mtt_samples.neutrino2_p4.at(sol_idx);
+              const double mtt = (sol_top1_p4 + sol_top2_p4).M();
 
-              ttbar[idx_comb_all] = ttbar_event_sols;
+              if (mtt < best_mtt) {
+                best_mtt = mtt;
+                best_top1_p4 = sol_top1_p4;
+                best_top2_p4 = sol_top2_p4;
+              }
             }
+
+            top1_p4 += best_top1_p4;
+            top2_p4 += best_top2_p4;
+            n_samples_with_solution++;
+          }
+
+#if TT_MTT_DEBUG
+          std::cout << "Smearing: " << n_samples_with_solution << " / " << mtt_samples.size() << " variations with solutions" << std::endl;
+#endif
+
+          if (n_samples_with_solution > 0) {
+            TTBar ttbar_sol(idx, myLorentzVector(top1_p4 / n_samples_with_solution), myLorentzVector(top2_p4 / n_samples_with_solution));
+            ttbar_sol.smeared = true;
+            ttbar_sol.weight = float(n_samples_with_solution) / mtt_samples.size();
+            ttbar_sols.push_back(ttbar_sol);
           }
         }
       }
+
+      // Sort solutions by increasing order of mtt
+      std::sort(ttbar_sols.begin(), ttbar_sols.end(), [](const TTBar& a, const TTBar& b) {
+                  return a.p4.M() < b.p4.M();
+              });
+    }
+  };
+
+  if (context.mttWorkers && mtt_candidates.size() >= m_neutrinosSolverParallelMinCandidates) {
+    // Smallest range of candidates given to a task, solving one or a few inputs only is not worth scheduling a task
+    const size_t mtt_task_candidates = 4;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, mtt_candidates.size(), mtt_task_candidates), [&](const tbb::blocked_range<size_t>& range) {
+      MttWorker& worker = context.mttWorkers->local();
+      mtt_solve(range.begin(), range.end(), worker.solvers.get(event.isRealData()), worker.samples);
+    });
+
+    // The statistics of the copies are merged back into the solvers of the context, where they are read below and at the end of the job
+    for (MttWorker& worker: *context.mttWorkers)
+      context.neutrinosSolvers.merge(worker.solvers);
+  } else {
+    mtt_solve(0, mtt_candidates.size(), neutrinosSolver, context.mtt.samples);
+  }
+
+  // Finally store the solutions of each candidate once, in the order of diLepDiJetsMet (see ttbar_offsets)
+  size_t mtt_n_solutions_total = 0;
+  for (size_t slot = 0; slot < mtt_candidates.size(); slot++)
+    mtt_n_solutions_total += mtt_solutions[slot].size();
+  ttbar.reserve(mtt_n_solutions_total);
+  ttbar_offsets.reserve(diLepDiJetsMet.size() + 1);
+
+  ttbar_offsets.push_back(0);
+  for (size_t idx = 0; idx < diLepDiJetsMet.size(); idx++) {
+    if (mtt_candidate_slot[idx] >= 0) {
+      const std::vector<TTBar>& ttbar_sols = mtt_solutions[mtt_candidate_slot[idx]];
+      ttbar.insert(ttbar.end(), ttbar_sols.begin(), ttbar_sols.end());
     }
+    ttbar_offsets.push_back(ttbar.size());
   }
 
+  if (m_neutrinosSolverStatisticsBranches) {
+    const NeutrinosSolver::Statistics& mtt_statistics = neutrinosSolver.statistics();
+
+    *m_neutrinosSolver_calls = mtt_statistics.calls - mtt_statistics_before.calls;
+
+    m_neutrinosSolver_nSolutions->resize(mtt_statistics.n_solutions.size());
+    for (size_t n = 0; n < mtt_statistics.n_solutions.size(); n++)
+      (*m_neutrinosSolver_nSolutions)[n] = mtt_statistics.n_solutions[n] - mtt_statistics_before.n_solutions[n];
+
+    *m_neutrinosSolver_degenerate = (mtt_statistics.branches.quads_deg - mtt_statistics_before.branches.quads_deg) +
+      (mtt_statistics.branches.zero_denominator - mtt_statistics_before.branches.zero_denominator);
+    *m_neutrinosSolver_time = mtt_statistics.time - mtt_statistics_before.time;
+  }
+}
+
+void TTAnalyzer::matchTrigger(const edm::Event& event, const ProducersManager& producers, EventContext& context) {
+
   ///////////////////////////
   //       TRIGGER         //
   ///////////////////////////
@@ -768,7 +985,7 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
 #if TT_HLT_DEBUG
           std::cout << "No HLT path triggered for this event. Skipping HLT matching." << std::endl;
 #endif
-          goto after_hlt_matching;
+          return;
       }
 
 #if TT_HLT_DEBUG
@@ -778,13 +995,17 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
       }
 #endif
 
+      context.leptonsHLTMatchTried.assign(leptons.size(), 0);
+
       /*
-       * Try to match `lepton` with an online object, using a deltaR and a deltaPt cut
+       * Try to match lepton `ilepton` with an online object, using a deltaR and a deltaPt cut
        * Returns the index inside the HLTProducer collection, or -1 if no match is found.
        */
-      auto matchOfflineLepton = [&](Lepton& lepton) {
+      auto matchOfflineLepton = [&](const uint16_t ilepton) {
 
-          if (lepton.hlt_already_tried_matching)
+          Lepton& lepton = leptons[ilepton];
+
+          if (context.leptonsHLTMatchTried[ilepton])
               return lepton.hlt_idx;
 
 #if TT_HLT_DEBUG
@@ -823,7 +1044,7 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
 #endif
 
           lepton.hlt_idx = index;
-          lepton.hlt_already_tried_matching = true;
+          context.leptonsHLTMatchTried[ilepton] = 1;
           lepton.hlt_DR_matched_object = min_dr;
           lepton.hlt_DPt_matched_object = std::abs(lepton.p4.Pt() - hlt.object_p4[index].Pt()) / lepton.p4.Pt();
 
@@ -834,14 +1055,16 @@ void TTAnalyzer::analyze(const edm::Event& event, const edm::EventSetup& setup,
       for (auto& m_diLepton: diLeptons) {
           // For each lepton of this pair, find the online object
           m_diLepton.hlt_idxs = std::make_pair(
-                  matchOfflineLepton(leptons[m_diLepton.lidxs.first]),
-                  matchOfflineLepton(leptons[m_diLepton.lidxs.second])
+                  matchOfflineLepton(m_diLepton.lidxs.first),
+                  matchOfflineLepton(m_diLepton.lidxs.second)
          );
       }
 
   }
+}
+
+void TTAnalyzer::classifyGen(const edm::Event& event, const ProducersManager& producers, EventContext& context) {
 
-after_hlt_matching:
 
     ///////////////////////////
     //       GEN INFO        //
@@ -851,6 +1074,8 @@ after_hlt_matching:
       std::cout << "Generator" << std::endl;
     #endif
 
+    context.genTTbarClassified = false;
+
     if (event.isRealData())
         return;
 
@@ -1175,6 +1400,16 @@ after_hlt_matching:
 
     gen_b_bbar_deltaR = VectorUtil::DeltaR(genParticles[gen_b].p4, genParticles[gen_bbar].p4);
 
+    context.genTTbarClassified = true;
+}
+
+void TTAnalyzer::matchGen(const edm::Event& event, const ProducersManager& producers, EventContext& context) {
+
+    if (!context.genTTbarClassified)
+        return;
+
+    const JetsProducer& jets = producers.get<JetsProducer>(m_jets_producer);
+
     if (gen_ttbar_decay_type > Hadronic) {
 
         float min_dr_lepton_t = std::numeric_limits<float>::max();
@@ -1210,9 +1445,8 @@ after_hlt_matching:
     // Match b quarks to jets
 
     const float MIN_DR_JETS = 0.8;
-    for (const auto& id: LepID::it) {
-      for (const auto& iso: LepIso::it) {
-          uint16_t IdWP = LepIDIso(id, iso);
+    for (const auto& lepWP: m_workingPoints.leptons()) {
+          uint16_t IdWP = LepIDIso(lepWP.id, lepWP.iso);
 
           float min_dr_b = MIN_DR_JETS;
           float min_dr_bbar = MIN_DR_JETS;
@@ -1260,7 +1494,6 @@ after_hlt_matching:
           gen_matched_bbar[IdWP] = local_gen_matched_bbar;
           gen_matched_b_beforeFSR[IdWP] = local_gen_matched_b_beforeFSR;
           gen_matched_bbar_beforeFSR[IdWP] = local_gen_matched_bbar_beforeFSR;
-      }
     }
 
     if (gen_b > -1 && gen_lepton_t > -1) {
@@ -1270,18 +1503,117 @@ after_hlt_matching:
     if (gen_bbar > -1 && gen_lepton_tbar > -1) {
         gen_bbar_lepton_tbar_deltaR = VectorUtil::DeltaR(genParticles[gen_bbar].p4, genParticles[gen_lepton_tbar].p4);
     }
+}
 
-    #ifdef _TT_DEBUG_
-      std::cout << "End event." << std::endl;
-    #endif
+TTAnalyzer::NeutrinosSolvers TTAnalyzer::makeNeutrinosSolvers() const {
+
+  // const float topWidth = isRealData ? 1.41 : 1.50833649;
+  // const float wWidth = isRealData ? 2.085 : 2.04759951;
+
+  NeutrinosSolvers solvers = { NeutrinosSolver(172.5, 80.419002), NeutrinosSolver(173.34, 80.385) };
+
+  NeutrinosSolver::PreFilter preFilter;
+  preFilter.enabled = m_neutrinosSolverPreFilter;
+  preFilter.max_mlb = m_neutrinosSolverMaxMlb;
+  preFilter.min_bjet_abs_pz = m_neutrinosSolverMinBJetAbsPz;
+
+  for (NeutrinosSolver* solver: {&solvers.mc, &solvers.data}) {
+    solver->setPreFilter(preFilter);
+    // Only the batched solver is used, so timing it costs nothing
+    solver->setTiming(true);
+  }
+
+  return solvers;
+}
+
+void TTAnalyzer::beginJob(MetadataManager&) {
+
+  m_context.reset(new EventContext(makeNeutrinosSolvers()));
+
+  // The copies of the solvers are made before any call, so that their statistics start from zero
+  if (m_neutrinosSolverParallelMinCandidates > 0)
+    m_context->mttWorkers.reset(new tbb::enumerable_thread_specific<MttWorker>(MttWorker{m_context->neutrinosSolvers, NeutrinosSolver::Samples()}));
+
+  if (m_concurrentStages)
+    buildStagesGraph(*m_context);
+}
+
+void TTAnalyzer::buildStagesGraph(EventContext& context) {
+
+  context.stagesGraph.reset(new EventContext::StagesGraph());
+  EventContext::StagesGraph& graph = *context.stagesGraph;
+
+  // One node per stage, following the dependencies of the stages; the graph is run once per event from its start node
+  for (const Stage& stage: stages()) {
+    graph.nodes.emplace_back(new tbb::flow::continue_node<tbb::flow::continue_msg>(graph.graph,
+          [this, &stage, &graph, &context](const tbb::flow::continue_msg&) {
+            (this->*stage.run)(*graph.event, *graph.producers, context);
+            return tbb::flow::continue_msg();
+          }));
+
+    if (stage.dependencies.empty())
+      tbb::flow::make_edge(graph.start, *graph.nodes.back());
+    for (const size_t dependency: stage.dependencies)
+      tbb::flow::make_edge(*graph.nodes[dependency], *graph.nodes.back());
+  }
+}
+
+void TTAnalyzer::endJob(MetadataManager&) {
+
+  if (!m_context)
+    return;
+
+  // A job does not mix simulation and data: the statistics of both solvers are simply summed
+  NeutrinosSolver solver = m_context->neutrinosSolvers.mc;
+  solver.merge(m_context->neutrinosSolvers.data);
+
+  const NeutrinosSolver::Statistics& statistics = solver.statistics();
+
+  std::cout << "Neutrinos solver: " << statistics.calls << " sets of inputs, " << statistics.solved << " solved in " << statistics.time << " s" << std::endl;
+  std::cout << "    number of solutions:";
+  for (size_t n = 0; n < statistics.n_solutions.size(); n++)
+    std::cout << " " << n << ": " << statistics.n_solutions[n];
+  std::cout << std::endl;
+  std::cout << "    degenerate branches: solve2QuadsDeg: " << statistics.branches.quads_deg << " (solve2Linear: " << statistics.branches.linear << ")"
+    << ", beta*e2 + gamma == 0: " << statistics.branches.zero_denominator << std::endl;
+
+  if (m_neutrinosSolverPreFilter) {
+    const NeutrinosSolver::PreFilterCounters& counters = solver.preFilterCounters();
+
+    std::cout << "Neutrinos solver pre-filter: " << counters.rejected_bjet_pz + counters.rejected_mlb << " / " << counters.tested << " inputs skipped" << std::endl;
+    std::cout << "    b-jet |pz| < " << m_neutrinosSolverMinBJetAbsPz << ": " << counters.rejected_bjet_pz << std::endl;
+    std::cout << "    m(l,b) above maximum: " << counters.rejected_mlb << std::endl;
+  }
+}
+
+void TTAnalyzer::beginRun(const edm::Run&, const edm::EventSetup&) {
+  // The content of the producers may change between runs
+  m_context->bTaggerChecked = false;
+  m_context->electronIDsChecked = false;
+}
+
+JetID::JetID TTAnalyzer::jetIDFromName(const std::string& jetID) {
+  if(jetID == "loose")
+    return JetID::L;
+
+  if(jetID == "tight")
+    return JetID::T;
+
+  if(jetID == "tightLeptonVeto")
+    return JetID::TLV;
 
+  throw edm::Exception(edm::errors::Configuration, "Unknown jetID '" + jetID + "' (expected 'loose', 'tight' or 'tightLeptonVeto')");
 }
 
 void TTAnalyzer::registerCategories(CategoryManager& manager, const edm::ParameterSet& config) {
-  manager.new_category<TTAnalysis::ElElCategory>("elel", "Category with leading leptons as two electrons", config);
-  manager.new_category<TTAnalysis::ElMuCategory>("elmu", "Category with leading leptons as electron, muon", config);
-  manager.new_category<TTAnalysis::MuElCategory>("muel", "Category with leading leptons as muon, electron", config);
-  manager.new_category<TTAnalysis::MuMuCategory>("mumu", "Category with leading leptons as two muons", config);
+  // The categories only register cuts for the combinations of working points computed by the analyzer
+  edm::ParameterSet categoriesConfig(config);
+  categoriesConfig.addUntrackedParameter<std::vector<std::string>>("workingPoints", m_workingPoints.names());
+
+  manager.new_category<TTAnalysis::ElElCategory>("elel", "Category with leading leptons as two electrons", categoriesConfig);
+  manager.new_category<TTAnalysis::ElMuCategory>("elmu", "Category with leading leptons as electron, muon", categoriesConfig);
+  manager.new_category<TTAnalysis::MuElCategory>("muel", "Category with leading leptons as muon, electron", categoriesConfig);
+  manager.new_category<TTAnalysis::MuMuCategory>("mumu", "Category with leading leptons as two muons", categoriesConfig);
 }
 
 #include <FWCore/PluginManager/interface/PluginFactory.h>
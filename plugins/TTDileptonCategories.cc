@@ -24,20 +24,14 @@ bool ElElCategory::event_in_category_post_analyzers(const ProducersManager& prod
 
   // It at least one DiLepton of highest Pt and of type ElEl among all ID pairs is found, keep event in this category
 
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          uint16_t comb = LepLepIDIso(id1, iso1, id2, iso2);
-          if(tt.diLeptons_IDIso[comb].size() >= 1) {
-            if( tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ].isElEl )
-              return true;
-          }
-        
-        }
-      }
+  for(const WorkingPoints::DiLepton& wp: m_diLeptonWorkingPoints) {
+    
+    uint16_t comb = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+    if(tt.diLeptons_IDIso[comb].size() >= 1) {
+      if( tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ].isElEl )
+        return true;
     }
+
   }
 
   return false;
@@ -45,24 +39,15 @@ bool ElElCategory::event_in_category_post_analyzers(const ProducersManager& prod
 
 void ElElCategory::register_cuts(CutManager& manager) {
   
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          std::string postFix("_");
-          postFix += LepLepIDIsoStr(id1, iso1, id2, iso2);
-          
-          manager.new_cut(baseStrCategory + postFix, baseStrCategory + postFix);
-          manager.new_cut(baseStrExtraDiLeptonVeto + postFix, baseStrExtraDiLeptonVeto + postFix);
-          manager.new_cut(baseStrDiLeptonTriggerMatch + postFix, baseStrDiLeptonTriggerMatch + postFix);
-          manager.new_cut(baseStrMllCut + postFix, baseStrMllCut + postFix);
-          manager.new_cut(baseStrMllZVetoCut + postFix, baseStrMllZVetoCut + postFix);
-          manager.new_cut(baseStrDiLeptonIsOS + postFix, baseStrDiLeptonIsOS + postFix);
+  for(const CutNames& cuts: m_cutNames) {
+    
+    manager.new_cut(cuts.category, cuts.category);
+    manager.new_cut(cuts.extraDiLeptonVeto, cuts.extraDiLeptonVeto);
+    manager.new_cut(cuts.diLeptonTriggerMatch, cuts.diLeptonTriggerMatch);
+    manager.new_cut(cuts.mll, cuts.mll);
+    manager.new_cut(cuts.mllZVeto, cuts.mllZVeto);
+    manager.new_cut(cuts.diLeptonIsOS, cuts.diLeptonIsOS);
 
-        }
-      }
-    }
   }
 
 }
@@ -72,47 +57,41 @@ void ElElCategory::evaluate_cuts_post_analyzers(CutManager& manager, const Produ
   const TTAnalyzer& tt = analyzers.get<TTAnalyzer>("tt");
   const HLTProducer& hlt = producers.get<HLTProducer>("hlt");
 
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          std::string postFix("_");
-          postFix += LepLepIDIsoStr(id1, iso1, id2, iso2);
-          uint16_t comb = LepLepIDIso(id1, iso1, id2, iso2);
+  for(size_t i = 0; i < m_diLeptonWorkingPoints.size(); i++) {
     
-          if(tt.diLeptons_IDIso[comb].size() >= 1) {
-            const DiLepton& m_diLepton = tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ];
-            
-            if(m_diLepton.isElEl) {
-              manager.pass_cut(baseStrCategory + postFix);
-
-              if(m_diLepton.hlt_idxs.first >= 0 && m_diLepton.hlt_idxs.second >= 0){
-                // We have fired a trigger. Now, check that it is actually a DoubleEG trigger
-                if( checkHLT(hlt, m_diLepton.hlt_idxs.first, m_diLepton.hlt_idxs.second, HLT::DoubleEG) )
-                  manager.pass_cut(baseStrDiLeptonTriggerMatch + postFix);
-              }
-              
-              if(m_diLepton.p4.M() > m_MllCutSF)
-                manager.pass_cut(baseStrMllCut + postFix);
-              
-              if(m_diLepton.p4.M() < m_MllZVetoCutLow || m_diLepton.p4.M() > m_MllZVetoCutHigh)
-                manager.pass_cut(baseStrMllZVetoCut + postFix);
-              
-              if(m_diLepton.isOS)
-                manager.pass_cut(baseStrDiLeptonIsOS + postFix);
-            }
-          }
-          
-          // For electrons, in principe only veto using VetoID.
-          // But since the user can access any cut he wants, he can take the IDVV_IsoWhatever cut.
-          if(tt.diLeptons_IDIso[comb].size() >= 2) { 
-            manager.pass_cut(baseStrExtraDiLeptonVeto + postFix);
-          }
-
+    const WorkingPoints::DiLepton& wp = m_diLeptonWorkingPoints[i];
+    const CutNames& cuts = m_cutNames[i];
+    uint16_t comb = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+
+    if(tt.diLeptons_IDIso[comb].size() >= 1) {
+      const DiLepton& m_diLepton = tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ];
+      
+      if(m_diLepton.isElEl) {
+        manager.pass_cut(cuts.category);
+
+        if(m_diLepton.hlt_idxs.first >= 0 && m_diLepton.hlt_idxs.second >= 0){
+          // We have fired a trigger. Now, check that it is actually a DoubleEG trigger
+          if( checkHLT(hlt, m_diLepton.hlt_idxs.first, m_diLepton.hlt_idxs.second, HLT::DoubleEG) )
+            manager.pass_cut(cuts.diLeptonTriggerMatch);
         }
+        
+        if(m_diLepton.p4.M() > m_MllCutSF)
+          manager.pass_cut(cuts.mll);
+        
+        if(m_diLepton.p4.M() < m_MllZVetoCutLow || m_diLepton.p4.M() > m_MllZVetoCutHigh)
+          manager.pass_cut(cuts.mllZVeto);
+        
+        if(m_diLepton.isOS)
+          manager.pass_cut(cuts.diLeptonIsOS);
       }
     }
+    
+    // For electrons, in principe only veto using VetoID.
+    // But since the user can access any cut he wants, he can take the IDVV_IsoWhatever cut.
+    if(tt.diLeptons_IDIso[comb].size() >= 2) { 
+      manager.pass_cut(cuts.extraDiLeptonVeto);
+    }
+
   }
 
 }
@@ -132,20 +111,14 @@ bool ElMuCategory::event_in_category_post_analyzers(const ProducersManager& prod
 
   // It at least one DiLepton of highest Pt and of type ElMu among all ID pairs is found, keep event in this category
 
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          uint16_t comb = LepLepIDIso(id1, iso1, id2, iso2);
-          if(tt.diLeptons_IDIso[comb].size() >= 1) {
-            if( tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ].isElMu )
-              return true;
-          }
-        
-        }
-      }
+  for(const WorkingPoints::DiLepton& wp: m_diLeptonWorkingPoints) {
+    
+    uint16_t comb = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+    if(tt.diLeptons_IDIso[comb].size() >= 1) {
+      if( tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ].isElMu )
+        return true;
     }
+
   }
 
   return false;
@@ -153,24 +126,15 @@ bool ElMuCategory::event_in_category_post_analyzers(const ProducersManager& prod
 
 void ElMuCategory::register_cuts(CutManager& manager) {
   
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          std::string postFix("_");
-          postFix += LepLepIDIsoStr(id1, iso1, id2, iso2);
-          
-          manager.new_cut(baseStrCategory + postFix, baseStrCategory + postFix);
-          manager.new_cut(baseStrExtraDiLeptonVeto + postFix, baseStrExtraDiLeptonVeto + postFix);
-          manager.new_cut(baseStrDiLeptonTriggerMatch + postFix, baseStrDiLeptonTriggerMatch + postFix);
-          manager.new_cut(baseStrMllCut + postFix, baseStrMllCut + postFix);
-          manager.new_cut(baseStrMllZVetoCut + postFix, baseStrMllZVetoCut + postFix);
-          manager.new_cut(baseStrDiLeptonIsOS + postFix, baseStrDiLeptonIsOS + postFix);
+  for(const CutNames& cuts: m_cutNames) {
+    
+    manager.new_cut(cuts.category, cuts.category);
+    manager.new_cut(cuts.extraDiLeptonVeto, cuts.extraDiLeptonVeto);
+    manager.new_cut(cuts.diLeptonTriggerMatch, cuts.diLeptonTriggerMatch);
+    manager.new_cut(cuts.mll, cuts.mll);
+    manager.new_cut(cuts.mllZVeto, cuts.mllZVeto);
+    manager.new_cut(cuts.diLeptonIsOS, cuts.diLeptonIsOS);
 
-        }
-      }
-    }
   }
 
 }
@@ -180,47 +144,41 @@ void ElMuCategory::evaluate_cuts_post_analyzers(CutManager& manager, const Produ
   const TTAnalyzer& tt = analyzers.get<TTAnalyzer>("tt");
   const HLTProducer& hlt = producers.get<HLTProducer>("hlt");
 
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          std::string postFix("_");
-          postFix += LepLepIDIsoStr(id1, iso1, id2, iso2);
-          uint16_t comb = LepLepIDIso(id1, iso1, id2, iso2);
+  for(size_t i = 0; i < m_diLeptonWorkingPoints.size(); i++) {
     
-          if(tt.diLeptons_IDIso[comb].size() >= 1) {
-            const DiLepton& m_diLepton = tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ];
-            
-            if(m_diLepton.isElMu) {
-              manager.pass_cut(baseStrCategory + postFix);
-
-              if(m_diLepton.hlt_idxs.first >= 0 && m_diLepton.hlt_idxs.second >= 0){
-                // We have fired a trigger. Now, check that it is actually a MuonEG trigger
-                if( checkHLT(hlt, m_diLepton.hlt_idxs.first, m_diLepton.hlt_idxs.second, HLT::MuonEG) )
-                  manager.pass_cut(baseStrDiLeptonTriggerMatch + postFix);
-              }
-              
-              if(m_diLepton.p4.M() > m_MllCutDF)
-                manager.pass_cut(baseStrMllCut + postFix);
-              
-              if(m_diLepton.p4.M() < m_MllZVetoCutLow || m_diLepton.p4.M() > m_MllZVetoCutHigh)
-                manager.pass_cut(baseStrMllZVetoCut + postFix);
-              
-              if(m_diLepton.isOS)
-                manager.pass_cut(baseStrDiLeptonIsOS + postFix);
-            }
-          }
-          
-          // For electrons, in principe only veto using VetoID.
-          // But since the user can access any cut he wants, he can take the IDVV_IsoWhatever cut.
-          if(tt.diLeptons_IDIso[comb].size() >= 2) { 
-            manager.pass_cut(baseStrExtraDiLeptonVeto + postFix);
-          }
-
+    const WorkingPoints::DiLepton& wp = m_diLeptonWorkingPoints[i];
+    const CutNames& cuts = m_cutNames[i];
+    uint16_t comb = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+
+    if(tt.diLeptons_IDIso[comb].size() >= 1) {
+      const DiLepton& m_diLepton = tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ];
+      
+      if(m_diLepton.isElMu) {
+        manager.pass_cut(cuts.category);
+
+        if(m_diLepton.hlt_idxs.first >= 0 && m_diLepton.hlt_idxs.second >= 0){
+          // We have fired a trigger. Now, check that it is actually a MuonEG trigger
+          if( checkHLT(hlt, m_diLepton.hlt_idxs.first, m_diLepton.hlt_idxs.second, HLT::MuonEG) )
+            manager.pass_cut(cuts.diLeptonTriggerMatch);
         }
+        
+        if(m_diLepton.p4.M() > m_MllCutDF)
+          manager.pass_cut(cuts.mll);
+        
+        if(m_diLepton.p4.M() < m_MllZVetoCutLow || m_diLepton.p4.M() > m_MllZVetoCutHigh)
+          manager.pass_cut(cuts.mllZVeto);
+        
+        if(m_diLepton.isOS)
+          manager.pass_cut(cuts.diLeptonIsOS);
       }
     }
+    
+    // For electrons, in principe only veto using VetoID.
+    // But since the user can access any cut he wants, he can take the IDVV_IsoWhatever cut.
+    if(tt.diLeptons_IDIso[comb].size() >= 2) { 
+      manager.pass_cut(cuts.extraDiLeptonVeto);
+    }
+
   }
 
 }
@@ -240,20 +198,14 @@ bool MuElCategory::event_in_category_post_analyzers(const ProducersManager& prod
 
   // It at least one DiLepton of highest Pt and of type MuEl among all ID pairs is found, keep event in this category
 
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          uint16_t comb = LepLepIDIso(id1, iso1, id2, iso2);
-          if(tt.diLeptons_IDIso[comb].size() >= 1) {
-            if( tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ].isMuEl )
-              return true;
-          }
-        
-        }
-      }
+  for(const WorkingPoints::DiLepton& wp: m_diLeptonWorkingPoints) {
+    
+    uint16_t comb = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+    if(tt.diLeptons_IDIso[comb].size() >= 1) {
+      if( tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ].isMuEl )
+        return true;
     }
+
   }
 
   return false;
@@ -261,24 +213,15 @@ bool MuElCategory::event_in_category_post_analyzers(const ProducersManager& prod
 
 void MuElCategory::register_cuts(CutManager& manager) {
   
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          std::string postFix("_");
-          postFix += LepLepIDIsoStr(id1, iso1, id2, iso2);
-          
-          manager.new_cut(baseStrCategory + postFix, baseStrCategory + postFix);
-          manager.new_cut(baseStrExtraDiLeptonVeto + postFix, baseStrExtraDiLeptonVeto + postFix);
-          manager.new_cut(baseStrDiLeptonTriggerMatch + postFix, baseStrDiLeptonTriggerMatch + postFix);
-          manager.new_cut(baseStrMllCut + postFix, baseStrMllCut + postFix);
-          manager.new_cut(baseStrMllZVetoCut + postFix, baseStrMllZVetoCut + postFix);
-          manager.new_cut(baseStrDiLeptonIsOS + postFix, baseStrDiLeptonIsOS + postFix);
+  for(const CutNames& cuts: m_cutNames) {
+    
+    manager.new_cut(cuts.category, cuts.category);
+    manager.new_cut(cuts.extraDiLeptonVeto, cuts.extraDiLeptonVeto);
+    manager.new_cut(cuts.diLeptonTriggerMatch, cuts.diLeptonTriggerMatch);
+    manager.new_cut(cuts.mll, cuts.mll);
+    manager.new_cut(cuts.mllZVeto, cuts.mllZVeto);
+    manager.new_cut(cuts.diLeptonIsOS, cuts.diLeptonIsOS);
 
-        }
-      }
-    }
   }
 
 }
@@ -288,47 +231,41 @@ void MuElCategory::evaluate_cuts_post_analyzers(CutManager& manager, const Produ
   const TTAnalyzer& tt = analyzers.get<TTAnalyzer>("tt");
   const HLTProducer& hlt = producers.get<HLTProducer>("hlt");
 
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          std::string postFix("_");
-          postFix += LepLepIDIsoStr(id1, iso1, id2, iso2);
-          uint16_t comb = LepLepIDIso(id1, iso1, id2, iso2);
+  for(size_t i = 0; i < m_diLeptonWorkingPoints.size(); i++) {
     
-          if(tt.diLeptons_IDIso[comb].size() >= 1) {
-            const DiLepton& m_diLepton = tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ];
-            
-            if(m_diLepton.isMuEl) {
-              manager.pass_cut(baseStrCategory + postFix);
-
-              if(m_diLepton.hlt_idxs.first >= 0 && m_diLepton.hlt_idxs.second >= 0){
-                // We have fired a trigger. Now, check that it is actually a MuonEG trigger
-                if( checkHLT(hlt, m_diLepton.hlt_idxs.first, m_diLepton.hlt_idxs.second, HLT::MuonEG) )
-                  manager.pass_cut(baseStrDiLeptonTriggerMatch + postFix);
-              }
-              
-              if(m_diLepton.p4.M() > m_MllCutDF)
-                manager.pass_cut(baseStrMllCut + postFix);
-              
-              if(m_diLepton.p4.M() < m_MllZVetoCutLow || m_diLepton.p4.M() > m_MllZVetoCutHigh)
-                manager.pass_cut(baseStrMllZVetoCut + postFix);
-              
-              if(m_diLepton.isOS)
-                manager.pass_cut(baseStrDiLeptonIsOS + postFix);
-            }
-          }
-          
-          // For electrons, in principe only veto using VetoID.
-          // But since the user can access any cut he wants, he can take the IDVV_IsoWhatever cut.
-          if(tt.diLeptons_IDIso[comb].size() >= 2) { 
-            manager.pass_cut(baseStrExtraDiLeptonVeto + postFix);
-          }
-
+    const WorkingPoints::DiLepton& wp = m_diLeptonWorkingPoints[i];
+    const CutNames& cuts = m_cutNames[i];
+    uint16_t comb = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+
+    if(tt.diLeptons_IDIso[comb].size() >= 1) {
+      const DiLepton& m_diLepton = tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ];
+      
+      if(m_diLepton.isMuEl) {
+        manager.pass_cut(cuts.category);
+
+        if(m_diLepton.hlt_idxs.first >= 0 && m_diLepton.hlt_idxs.second >= 0){
+          // We have fired a trigger. Now, check that it is actually a MuonEG trigger
+          if( checkHLT(hlt, m_diLepton.hlt_idxs.first, m_diLepton.hlt_idxs.second, HLT::MuonEG) )
+            manager.pass_cut(cuts.diLeptonTriggerMatch);
         }
+        
+        if(m_diLepton.p4.M() > m_MllCutDF)
+          manager.pass_cut(cuts.mll);
+        
+        if(m_diLepton.p4.M() < m_MllZVetoCutLow || m_diLepton.p4.M() > m_MllZVetoCutHigh)
+          manager.pass_cut(cuts.mllZVeto);
+        
+        if(m_diLepton.isOS)
+          manager.pass_cut(cuts.diLeptonIsOS);
       }
     }
+    
+    // For electrons, in principe only veto using VetoID.
+    // But since the user can access any cut he wants, he can take the IDVV_IsoWhatever cut.
+    if(tt.diLeptons_IDIso[comb].size() >= 2) { 
+      manager.pass_cut(cuts.extraDiLeptonVeto);
+    }
+
   }
 
 }
@@ -347,20 +284,14 @@ bool MuMuCategory::event_in_category_post_analyzers(const ProducersManager& prod
 
   // It at least one DiLepton of highest Pt and of type MuMu among all ID pairs is found, keep event in this category
 
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          uint16_t comb = LepLepIDIso(id1, iso1, id2, iso2);
-          if(tt.diLeptons_IDIso[comb].size() >= 1) {
-            if( tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ].isMuMu )
-              return true;
-          }
-        
-        }
-      }
+  for(const WorkingPoints::DiLepton& wp: m_diLeptonWorkingPoints) {
+    
+    uint16_t comb = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+    if(tt.diLeptons_IDIso[comb].size() >= 1) {
+      if( tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ].isMuMu )
+        return true;
     }
+
   }
 
   return false;
@@ -368,24 +299,15 @@ bool MuMuCategory::event_in_category_post_analyzers(const ProducersManager& prod
 
 void MuMuCategory::register_cuts(CutManager& manager) {
   
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          std::string postFix("_");
-          postFix += LepLepIDIsoStr(id1, iso1, id2, iso2);
-          
-          manager.new_cut(baseStrCategory + postFix, baseStrCategory + postFix);
-          manager.new_cut(baseStrExtraDiLeptonVeto + postFix, baseStrExtraDiLeptonVeto + postFix);
-          manager.new_cut(baseStrDiLeptonTriggerMatch + postFix, baseStrDiLeptonTriggerMatch + postFix);
-          manager.new_cut(baseStrMllCut + postFix, baseStrMllCut + postFix);
-          manager.new_cut(baseStrMllZVetoCut + postFix, baseStrMllZVetoCut + postFix);
-          manager.new_cut(baseStrDiLeptonIsOS + postFix, baseStrDiLeptonIsOS + postFix);
+  for(const CutNames& cuts: m_cutNames) {
+    
+    manager.new_cut(cuts.category, cuts.category);
+    manager.new_cut(cuts.extraDiLeptonVeto, cuts.extraDiLeptonVeto);
+    manager.new_cut(cuts.diLeptonTriggerMatch, cuts.diLeptonTriggerMatch);
+    manager.new_cut(cuts.mll, cuts.mll);
+    manager.new_cut(cuts.mllZVeto, cuts.mllZVeto);
+    manager.new_cut(cuts.diLeptonIsOS, cuts.diLeptonIsOS);
 
-        }
-      }
-    }
   }
 
 }
@@ -395,45 +317,39 @@ void MuMuCategory::evaluate_cuts_post_analyzers(CutManager& manager, const Produ
   const TTAnalyzer& tt = analyzers.get<TTAnalyzer>("tt");
   const HLTProducer& hlt = producers.get<HLTProducer>("hlt");
 
-  for(const LepID::LepID& id1: LepID::it) {
-    for(const LepID::LepID& id2: LepID::it) {
-      for(const LepIso::LepIso& iso1: LepIso::it) {
-        for(const LepIso::LepIso& iso2: LepIso::it) {
-          
-          std::string postFix("_");
-          postFix += LepLepIDIsoStr(id1, iso1, id2, iso2);
-          uint16_t comb = LepLepIDIso(id1, iso1, id2, iso2);
+  for(size_t i = 0; i < m_diLeptonWorkingPoints.size(); i++) {
     
-          if(tt.diLeptons_IDIso[comb].size() >= 1) {
-            const DiLepton& m_diLepton = tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ];
-            
-            if(m_diLepton.isMuMu) {
-              manager.pass_cut(baseStrCategory + postFix);
-
-              if(m_diLepton.hlt_idxs.first >= 0 && m_diLepton.hlt_idxs.second >= 0){
-                // We have fired a trigger. Now, check that it is actually a DoubleMuon trigger
-                if( checkHLT(hlt, m_diLepton.hlt_idxs.first, m_diLepton.hlt_idxs.second, HLT::DoubleMuon) )
-                  manager.pass_cut(baseStrDiLeptonTriggerMatch + postFix);
-              }
-              
-              if(m_diLepton.p4.M() > m_MllCutSF)
-                manager.pass_cut(baseStrMllCut + postFix);
-              
-              if(m_diLepton.p4.M() < m_MllZVetoCutLow || m_diLepton.p4.M() > m_MllZVetoCutHigh)
-                manager.pass_cut(baseStrMllZVetoCut + postFix);
-              
-              if(m_diLepton.isOS)
-                manager.pass_cut(baseStrDiLeptonIsOS + postFix);
-            }
-          }
-          
-          if(tt.diLeptons_IDIso[comb].size() >= 2) { 
-            manager.pass_cut(baseStrExtraDiLeptonVeto + postFix);
-          }
-
+    const WorkingPoints::DiLepton& wp = m_diLeptonWorkingPoints[i];
+    const CutNames& cuts = m_cutNames[i];
+    uint16_t comb = LepLepIDIso(wp.id1, wp.iso1, wp.id2, wp.iso2);
+
+    if(tt.diLeptons_IDIso[comb].size() >= 1) {
+      const DiLepton& m_diLepton = tt.diLeptons[ tt.diLeptons_IDIso[comb][0] ];
+      
+      if(m_diLepton.isMuMu) {
+        manager.pass_cut(cuts.category);
+
+        if(m_diLepton.hlt_idxs.first >= 0 && m_diLepton.hlt_idxs.second >= 0){
+          // We have fired a trigger. Now, check that it is actually a DoubleMuon trigger
+          if( checkHLT(hlt, m_diLepton.hlt_idxs.first, m_diLepton.hlt_idxs.second, HLT::DoubleMuon) )
+            manager.pass_cut(cuts.diLeptonTriggerMatch);
         }
+        
+        if(m_diLepton.p4.M() > m_MllCutSF)
+          manager.pass_cut(cuts.mll);
+        
+        if(m_diLepton.p4.M() < m_MllZVetoCutLow || m_diLepton.p4.M() > m_MllZVetoCutHigh)
+          manager.pass_cut(cuts.mllZVeto);
+        
+        if(m_diLepton.isOS)
+          manager.pass_cut(cuts.diLeptonIsOS);
       }
     }
+    
+    if(tt.diLeptons_IDIso[comb].size() >= 2) { 
+      manager.pass_cut(cuts.extraDiLeptonVeto);
+    }
+
   }
 
 }
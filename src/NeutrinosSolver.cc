@@ -2,134 +2,697 @@
 
 #include <Math/Vector3D.h>
 
-std::vector<std::pair<NeutrinosSolver::LorentzVector, NeutrinosSolver::LorentzVector>> NeutrinosSolver::getNeutrinos(const LorentzVector& lepton1_p4, 
-        const LorentzVector& lepton2_p4, 
-        const LorentzVector& bjet1_p4, 
-        const LorentzVector& bjet2_p4,
-        const LorentzVector& met) {
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <type_traits>
+
+template<typename T> const size_t BasicNeutrinosSolver<T>::maxSolutions;
+template<typename T> const size_t BasicNeutrinosSolver<T>::blockSize;
+
+namespace {
+
+    // Elimination of E1 between the two conics a20 E1^2 + a02 E2^2 + a11 E1E2 + a10 E1 + a01 E2 + a00 = 0 (id. with bij),
+    // valid if a20 != 0 or b20 != 0: the solutions for E2 are the roots of the quartic a E2^4 + b E2^3 + c E2^2 + d E2 + e,
+    // and E1 is then given by E1 = -(alpha E2^2 + delta E2 + omega)/(beta E2 + gamma).
+    template<typename T>
+    struct Elimination {
+        T alpha, beta, gamma, delta, omega;
+        T a, b, c, d, e;
+    };
+
+    template<typename T>
+    inline Elimination<T> eliminateE1(const T a20, const T a02, const T a11, const T a10, const T a01, const T a00, const T b20, const T b02, const T b11, const T b10, const T b01, const T b00) {
+
+        Elimination<T> r;
+
+        r.alpha = b20*a02-a20*b02;
+        r.beta = b20*a11-a20*b11;
+        r.gamma = b20*a10-a20*b10;
+        r.delta = b20*a01-a20*b01;
+        r.omega = b20*a00-a20*b00;
+
+        const T alpha = r.alpha, beta = r.beta, gamma = r.gamma, delta = r.delta, omega = r.omega;
+
+        r.a = a20*SQ(alpha) + a02*SQ(beta) - a11*alpha*beta;
+        r.b = T(2)*a20*alpha*delta - a11*( alpha*gamma + delta*beta ) - a10*alpha*beta + T(2)*a02*beta*gamma + a01*SQ(beta);
+        r.c = a20*SQ(delta) + T(2)*a20*alpha*omega - a11*( delta*gamma + omega*beta ) - a10*( alpha*gamma + delta*beta )
+            + a02*SQ(gamma) + T(2)*a01*beta*gamma + a00*SQ(beta);
+        r.d = T(2)*a20*delta*omega - a11*omega*gamma - a10*( delta*gamma + omega*beta ) + a01*SQ(gamma) + T(2)*a00*beta*gamma;
+        r.e = a20*SQ(omega) - a10*omega*gamma + a00*SQ(gamma);
+
+        return r;
+    }
 
+    // Coefficients for one set of inputs, written in terms of plain scalars so that the loop of the batched solver can be vectorized.
+    // p3 = lepton 1, p4 = b-jet 1, p5 = lepton 2, p6 = b-jet 2, pT = transverse momentum of the visible particles and ISR.
+    // The computation is split in a mass-independent and a mass-dependent part, used separately by the mass scan, and the
+    // mass-independent part in terms depending on only one (lepton, b-jet) pair, used separately by the two-stage version.
+    // Forced inline: the loop is only vectorized if the compiler sees through the calls.
+    // The computation is branch-free, so that it can also be instantiated directly with SIMD pack types for T.
+    template<typename T>
+    inline __attribute__((always_inline)) void fillPairTerms(
+            const T lx, const T ly, const T lz, const T lE,
+            const T bx, const T by, const T bz, const T bE,
+            NeutrinosSolverPairTerms<T>& p) {
+
+        p.lx = lx; p.ly = ly; p.lz = lz; p.lE = lE;
+        p.bx = bx; p.by = by; p.bz = bz; p.bE = bE;
+
+        p.lb = lE*bE - lx*bx - ly*by - lz*bz;
+        p.ll = lE*lE - lx*lx - ly*ly - lz*lz;
+        p.bb = bE*bE - bx*bx - by*by - bz*bz;
+
+        p.A = T(2)*( -lx + lz*bx/bz );
+        p.B = T(2)*( -ly + lz*by/bz );
+        p.r = lz/bz;
+        p.e = lE - bE*lz/bz;
+    }
 
-    // pT = transverse total momentum of the visible particles
-    // It will be used to reconstruct neutrinos, but we want to take into account the measured ISR (pt_isr = - pt_met - pt_vis),
-    // so we add pt_isr to pt_vis in order to have pt_vis + pt_nu + pt_isr = 0 as it should be.
-
-    const LorentzVector& p3 = lepton1_p4;
-    const LorentzVector& p4 = bjet1_p4;
-    const LorentzVector& p5 = lepton2_p4;
-    const LorentzVector& p6 = bjet2_p4;
-
-    double s13 = w_mass * w_mass;
-    double s134 = t_mass * t_mass;
-    double s25 = w_mass * w_mass;
-    double s256 = t_mass * t_mass;
-
-    LorentzVector ISR = -(lepton1_p4 + lepton2_p4 + bjet1_p4 + bjet2_p4 + met);
-    LorentzVector pT = lepton1_p4 + lepton2_p4 + bjet1_p4 + bjet2_p4 + ISR;
-
-    const double p34 = p3.Dot(p4);
-    const double p56 = p5.Dot(p6);
-    const double p33 = p3.M2();
-    const double p44 = p4.M2();
-    const double p55 = p5.M2();
-    const double p66 = p6.M2();
-
-    // A1 p1x + B1 p1y + C1 = 0, with C1(E1,E2)
-    // A2 p1y + B2 p2y + C2 = 0, with C2(E1,E2)
-    // ==> express p1x and p1y as functions of E1, E2
-
-    const double A1 = 2.*( -p3.Px() + p3.Pz()*p4.Px()/p4.Pz() );
-    const double A2 = 2.*( p5.Px() - p5.Pz()*p6.Px()/p6.Pz() );
-
-    const double B1 = 2.*( -p3.Py() + p3.Pz()*p4.Py()/p4.Pz() );
-    const double B2 = 2.*( p5.Py() - p5.Pz()*p6.Py()/p6.Pz() );
-
-    const double Dx = B2*A1 - B1*A2;
-    const double Dy = A2*B1 - A1*B2;
-
-    const double X = 2*( pT.Px()*p5.Px() + pT.Py()*p5.Py() - p5.Pz()/p6.Pz()*( 0.5*(s25 - s256 + p66) + p56 + pT.Px()*p6.Px() + pT.Py()*p6.Py() ) ) + p55 - s25;
-    const double Y = p3.Pz()/p4.Pz()*( s13 - s134 + 2*p34 + p44 ) - p33 + s13;
-
-    // p1x = alpha1 E1 + beta1 E2 + gamma1
-    // p1y = ...(2)
-    // p1z = ...(3)
-    // p2z = ...(4)
-    // p2x = ...(5)
-    // p2y = ...(6)
-
-    const double alpha1 = -2*B2*(p3.E() - p4.E()*p3.Pz()/p4.Pz())/Dx;
-    const double beta1 = 2*B1*(p5.E() - p6.E()*p5.Pz()/p6.Pz())/Dx;
-    const double gamma1 = B1*X/Dx + B2*Y/Dx;
-
-    const double alpha2 = -2*A2*(p3.E() - p4.E()*p3.Pz()/p4.Pz())/Dy;
-    const double beta2 = 2*A1*(p5.E() - p6.E()*p5.Pz()/p6.Pz())/Dy;
-    const double gamma2 = A1*X/Dy + A2*Y/Dy;
-
-    const double alpha3 = (p4.E() - alpha1*p4.Px() - alpha2*p4.Py())/p4.Pz();
-    const double beta3 = -(beta1*p4.Px() + beta2*p4.Py())/p4.Pz();
-    const double gamma3 = ( 0.5*(s13 - s134 + p44) + p34 - gamma1*p4.Px() - gamma2*p4.Py() )/p4.Pz();
-
-    const double alpha4 = (alpha1*p6.Px() + alpha2*p6.Py())/p6.Pz();
-    const double beta4 = (p6.E() + beta1*p6.Px() + beta2*p6.Py())/p6.Pz();
-    const double gamma4 = ( 0.5*(s25 - s256 + p66) + p56 + (gamma1 + pT.Px())*p6.Px() + (gamma2 + pT.Py())*p6.Py() )/p6.Pz();
-
-    const double alpha5 = -alpha1;
-    const double beta5 = -beta1;
-    const double gamma5 = -pT.Px() - gamma1;
-
-    const double alpha6 = -alpha2;
-    const double beta6 = -beta2;
-    const double gamma6 = -pT.Py() - gamma2;
-
-    // a11 E1^2 + a22 E2^2 + a12 E1E2 + a10 E1 + a01 E2 + a00 = 0
-    // id. with bij
-
-    const double a11 = -1 + ( SQ(alpha1) + SQ(alpha2) + SQ(alpha3) );
-    const double a22 = SQ(beta1) + SQ(beta2) + SQ(beta3);
-    const double a12 = 2.*( alpha1*beta1 + alpha2*beta2 + alpha3*beta3 );
-    const double a10 = 2.*( alpha1*gamma1 + alpha2*gamma2 + alpha3*gamma3 );
-    const double a01 = 2.*( beta1*gamma1 + beta2*gamma2 + beta3*gamma3 );
-    const double a00 = SQ(gamma1) + SQ(gamma2) + SQ(gamma3);
-
-    const double b11 = SQ(alpha5) + SQ(alpha6) + SQ(alpha4);
-    const double b22 = -1 + ( SQ(beta5) + SQ(beta6) + SQ(beta4) );
-    const double b12 = 2.*( alpha5*beta5 + alpha6*beta6 + alpha4*beta4 );
-    const double b10 = 2.*( alpha5*gamma5 + alpha6*gamma6 + alpha4*gamma4 );
-    const double b01 = 2.*( beta5*gamma5 + beta6*gamma6 + beta4*gamma4 );
-    const double b00 = SQ(gamma5) + SQ(gamma6) + SQ(gamma4);
-
-    // Find the intersection of the 2 conics (at most 4 real solutions for (E1,E2))
-    std::vector<double> E1, E2;
-    solve2Quads(a11, a22, a12, a10, a01, a00, b11, b22, b12, b10, b01, b00, E1, E2);
-
-    // For each solution (E1,E2), find the neutrino 4-momenta p1,p2
-    std::vector<std::pair<LorentzVector, LorentzVector>> neutrinos;
+    // Mass-independent coefficients from the terms of the pairs (p3, p4) and (p5, p6)
+    template<typename T, typename Coefficients>
+    inline __attribute__((always_inline)) void combinePairTerms(
+            const NeutrinosSolverPairTerms<T>& p1,
+            const NeutrinosSolverPairTerms<T>& p2,
+            const T pTx, const T pTy,
+            NeutrinosSolverMassIndependentTerms<T>& m,
+            Coefficients& c) {
+
+        m.pTx = pTx; m.pTy = pTy;
+        m.p4x = p1.bx; m.p4y = p1.by; m.p4z = p1.bz;
+        m.p6x = p2.bx; m.p6y = p2.by; m.p6z = p2.bz;
+
+        m.p34 = p1.lb;
+        m.p56 = p2.lb;
+        m.p33 = p1.ll;
+        m.p44 = p1.bb;
+        m.p55 = p2.ll;
+        m.p66 = p2.bb;
+
+        // A1 p1x + B1 p1y + C1 = 0, with C1(E1,E2)
+        // A2 p1y + B2 p2y + C2 = 0, with C2(E1,E2)
+        // ==> express p1x and p1y as functions of E1, E2
+        // A2 = 2( p5x - p5z p6x/p6z ) is exactly the opposite of the A term of the second pair, id. for B2
+
+        const T A1 = m.A1 = p1.A;
+        const T A2 = m.A2 = -p2.A;
+
+        const T B1 = m.B1 = p1.B;
+        const T B2 = m.B2 = -p2.B;
+
+        const T Dx = m.Dx = B2*A1 - B1*A2;
+        const T Dy = m.Dy = A2*B1 - A1*B2;
+
+        // Mass-independent parts of X and Y, see below
+        m.pT5 = pTx*p2.lx + pTy*p2.ly;
+        m.r6 = p2.r;
+        m.pT6x = pTx*p2.bx;
+        m.pT6y = pTy*p2.by;
+        m.r4 = p1.r;
+
+        c.alpha1 = -T(2)*B2*p1.e/Dx;
+        c.beta1 = T(2)*B1*p2.e/Dx;
+
+        c.alpha2 = -T(2)*A2*p1.e/Dy;
+        c.beta2 = T(2)*A1*p2.e/Dy;
+
+        c.alpha3 = (p1.bE - c.alpha1*p1.bx - c.alpha2*p1.by)/p1.bz;
+        c.beta3 = -(c.beta1*p1.bx + c.beta2*p1.by)/p1.bz;
+
+        c.alpha4 = (c.alpha1*p2.bx + c.alpha2*p2.by)/p2.bz;
+        c.beta4 = (p2.bE + c.beta1*p2.bx + c.beta2*p2.by)/p2.bz;
+
+        c.alpha5 = -c.alpha1;
+        c.beta5 = -c.beta1;
+
+        c.alpha6 = -c.alpha2;
+        c.beta6 = -c.beta2;
+
+        c.a11 = T(-1) + ( SQ(c.alpha1) + SQ(c.alpha2) + SQ(c.alpha3) );
+        c.a22 = SQ(c.beta1) + SQ(c.beta2) + SQ(c.beta3);
+        c.a12 = T(2)*( c.alpha1*c.beta1 + c.alpha2*c.beta2 + c.alpha3*c.beta3 );
+
+        c.b11 = SQ(c.alpha5) + SQ(c.alpha6) + SQ(c.alpha4);
+        c.b22 = T(-1) + ( SQ(c.beta5) + SQ(c.beta6) + SQ(c.beta4) );
+        c.b12 = T(2)*( c.alpha5*c.beta5 + c.alpha6*c.beta6 + c.alpha4*c.beta4 );
+    }
+
+    template<typename T, typename Coefficients>
+    inline __attribute__((always_inline)) void fillMassIndependentCoefficients(
+            const T p3x, const T p3y, const T p3z, const T p3E,
+            const T p4x, const T p4y, const T p4z, const T p4E,
+            const T p5x, const T p5y, const T p5z, const T p5E,
+            const T p6x, const T p6y, const T p6z, const T p6E,
+            const T pTx, const T pTy,
+            NeutrinosSolverMassIndependentTerms<T>& m,
+            Coefficients& c) {
+
+        NeutrinosSolverPairTerms<T> p1, p2;
+        fillPairTerms(p3x, p3y, p3z, p3E, p4x, p4y, p4z, p4E, p1);
+        fillPairTerms(p5x, p5y, p5z, p5E, p6x, p6y, p6z, p6E, p2);
+        combinePairTerms(p1, p2, pTx, pTy, m, c);
+    }
+
+    // Complete the coefficients filled by fillMassIndependentCoefficients for the masses entering s13 = mW1^2, s134 = mt1^2,
+    // s25 = mW2^2 and s256 = mt2^2
+    template<typename T, typename Coefficients>
+    inline __attribute__((always_inline)) void fillMassDependentCoefficients(
+            const NeutrinosSolverMassIndependentTerms<T>& m,
+            const T s13, const T s134, const T s25, const T s256,
+            Coefficients& c) {
+
+        const T X = T(2)*( m.pT5 - m.r6*( T(0.5)*(s25 - s256 + m.p66) + m.p56 + m.pT6x + m.pT6y ) ) + m.p55 - s25;
+        const T Y = m.r4*( s13 - s134 + T(2)*m.p34 + m.p44 ) - m.p33 + s13;
+
+        c.gamma1 = m.B1*X/m.Dx + m.B2*Y/m.Dx;
+        c.gamma2 = m.A1*X/m.Dy + m.A2*Y/m.Dy;
+        c.gamma3 = ( T(0.5)*(s13 - s134 + m.p44) + m.p34 - c.gamma1*m.p4x - c.gamma2*m.p4y )/m.p4z;
+        c.gamma4 = ( T(0.5)*(s25 - s256 + m.p66) + m.p56 + (c.gamma1 + m.pTx)*m.p6x + (c.gamma2 + m.pTy)*m.p6y )/m.p6z;
+        c.gamma5 = -m.pTx - c.gamma1;
+        c.gamma6 = -m.pTy - c.gamma2;
+
+        c.a10 = T(2)*( c.alpha1*c.gamma1 + c.alpha2*c.gamma2 + c.alpha3*c.gamma3 );
+        c.a01 = T(2)*( c.beta1*c.gamma1 + c.beta2*c.gamma2 + c.beta3*c.gamma3 );
+        c.a00 = SQ(c.gamma1) + SQ(c.gamma2) + SQ(c.gamma3);
+
+        c.b10 = T(2)*( c.alpha5*c.gamma5 + c.alpha6*c.gamma6 + c.alpha4*c.gamma4 );
+        c.b01 = T(2)*( c.beta5*c.gamma5 + c.beta6*c.gamma6 + c.beta4*c.gamma4 );
+        c.b00 = SQ(c.gamma5) + SQ(c.gamma6) + SQ(c.gamma4);
+    }
+
+    template<typename T, typename Coefficients>
+    inline __attribute__((always_inline)) void fillCoefficients(
+            const T p3x, const T p3y, const T p3z, const T p3E,
+            const T p4x, const T p4y, const T p4z, const T p4E,
+            const T p5x, const T p5y, const T p5z, const T p5E,
+            const T p6x, const T p6y, const T p6z, const T p6E,
+            const T pTx, const T pTy,
+            const T s13, const T s134, const T s25, const T s256,
+            Coefficients& c) {
+
+        NeutrinosSolverMassIndependentTerms<T> m;
+        fillMassIndependentCoefficients(p3x, p3y, p3z, p3E, p4x, p4y, p4z, p4E, p5x, p5y, p5z, p5E, p6x, p6y, p6z, p6E, pTx, pTy, m, c);
+        fillMassDependentCoefficients(m, s13, s134, s25, s256, c);
+    }
+
+    // Squared invariant mass of the sum of two four-momenta
+    template<typename T>
+    inline T invariantMass2(const T x1, const T y1, const T z1, const T E1, const T x2, const T y2, const T z2, const T E2) {
+        return SQ((E1 + E2)) - SQ((x1 + x2)) - SQ((y1 + y2)) - SQ((z1 + z2));
+    }
+
+    // Conics coefficients for the energies expressed in units of `scale`, so that all the coefficients are of order one.
+    // Without this, the coefficients of the intermediate quartic do not fit the single precision.
+    struct NormalizedConics {
+        double scale;
+        double a20, a02, a11, a10, a01, a00;
+        double b20, b02, b11, b10, b01, b00;
+
+        template<typename Coefficients>
+        explicit NormalizedConics(const Coefficients& c) {
+            const double max_c00 = std::max<double>(c.a00, c.b00);
+            scale = (max_c00 > 0.) ? std::sqrt(max_c00) : 1.;
+
+            const double inv_scale = 1. / scale;
+            const double inv_scale2 = inv_scale * inv_scale;
+
+            a20 = c.a11; a02 = c.a22; a11 = c.a12; a10 = c.a10 * inv_scale; a01 = c.a01 * inv_scale; a00 = c.a00 * inv_scale2;
+            b20 = c.b11; b02 = c.b22; b11 = c.b12; b10 = c.b10 * inv_scale; b01 = c.b01 * inv_scale; b00 = c.b00 * inv_scale2;
+        }
+
+        // Intersect the normalized conics in single precision, and bring the solutions back to the original units
+        bool solve(BasicRoots<float>& E1, BasicRoots<float>& E2, ConicsBranchCounters* counters) const {
+            const bool result = solve2Quads<float>(a20, a02, a11, a10, a01, a00, b20, b02, b11, b10, b01, b00, E1, E2, counters);
+
+            for (size_t i = 0; i < E1.size(); i++) {
+                E1[i] *= scale;
+                E2[i] *= scale;
+            }
+
+            return result;
+        }
+    };
+
+    // Measures the time spent in its scope if enabled, adding it to `time`
+    class ScopedTimer {
+        public:
+            ScopedTimer(bool enabled, double& time): m_enabled(enabled), m_time(time) {
+                if (m_enabled)
+                    m_start = std::chrono::steady_clock::now();
+            }
+
+            ~ScopedTimer() {
+                if (m_enabled)
+                    m_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+            }
+
+        private:
+            const bool m_enabled;
+            double& m_time;
+            std::chrono::steady_clock::time_point m_start;
+    };
+
+    // Random stream used by the sampling mode: splitmix64 generator, with normal deviates from the Box-Muller transform.
+    // Everything is specified here, so the stream only depends on the seed and not on the standard library implementation.
+    class NormalStream {
+        public:
+            explicit NormalStream(uint64_t seed): m_state(seed) {}
+
+            double next() {
+                if (m_hasSpare) {
+                    m_hasSpare = false;
+                    return m_spare;
+                }
+
+                // 53 random bits, giving u1 uniform in (0, 1] (so that the logarithm is always defined) and u2 in [0, 1)
+                const double two_pow_m53 = 1. / 9007199254740992.;
+                const double u1 = ((nextInteger() >> 11) + 1) * two_pow_m53;
+                const double u2 = (nextInteger() >> 11) * two_pow_m53;
+
+                const double r = std::sqrt(-2. * std::log(u1));
+                const double phi = 2. * M_PI * u2;
 
+                m_spare = r * std::sin(phi);
+                m_hasSpare = true;
+
+                return r * std::cos(phi);
+            }
+
+        private:
+            uint64_t nextInteger() {
+                uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                return z ^ (z >> 31);
+            }
+
+            uint64_t m_state;
+            double m_spare = 0.;
+            bool m_hasSpare = false;
+    };
+
+}
+
+template<typename T>
+void BasicNeutrinosSolver<T>::merge(const BasicNeutrinosSolver& other) {
+    m_preFilterCounters.tested += other.m_preFilterCounters.tested;
+    m_preFilterCounters.rejected_bjet_pz += other.m_preFilterCounters.rejected_bjet_pz;
+    m_preFilterCounters.rejected_mlb += other.m_preFilterCounters.rejected_mlb;
+
+    m_statistics.calls += other.m_statistics.calls;
+    m_statistics.solved += other.m_statistics.solved;
+    for (size_t i = 0; i < m_statistics.n_solutions.size(); i++)
+        m_statistics.n_solutions[i] += other.m_statistics.n_solutions[i];
+    m_statistics.branches += other.m_statistics.branches;
+    m_statistics.time += other.m_statistics.time;
+}
+
+template<typename T>
+uint8_t BasicNeutrinosSolver<T>::solveConics(const Coefficients& c, const P4Array& p1, const P4Array& p2, const size_t offset) {
+
+    BasicRoots<T> E1, E2;
+
+    if (std::is_same<T, float>::value) {
+        BasicRoots<float> E1f, E2f;
+        NormalizedConics(c).solve(E1f, E2f, &m_statistics.branches);
+        for (size_t i = 0; i < E1f.size(); i++) {
+            E1.push_back(E1f[i]);
+            E2.push_back(E2f[i]);
+        }
+    } else {
+        solve2Quads(c.a11, c.a22, c.a12, c.a10, c.a01, c.a00, c.b11, c.b22, c.b12, c.b10, c.b01, c.b00, E1, E2, &m_statistics.branches);
+    }
+
+    uint8_t n = 0;
     for (size_t i = 0; i < E1.size(); i++){
-        const double e1 = E1.at(i);
-        const double e2 = E2.at(i);
+        const T e1 = E1[i];
+        const T e2 = E2[i];
 
         if (e1 < 0. || e2 < 0.)
             continue;
 
-        LorentzVector p1(
-                alpha1*e1 + beta1*e2 + gamma1,
-                alpha2*e1 + beta2*e2 + gamma2,
-                alpha3*e1 + beta3*e2 + gamma3,
-                e1);
+        const size_t j = offset + n;
+
+        p1.px[j] = c.alpha1*e1 + c.beta1*e2 + c.gamma1;
+        p1.py[j] = c.alpha2*e1 + c.beta2*e2 + c.gamma2;
+        p1.pz[j] = c.alpha3*e1 + c.beta3*e2 + c.gamma3;
+        p1.E[j] = e1;
 
-        LorentzVector p2(
-                alpha5*e1 + beta5*e2 + gamma5,
-                alpha6*e1 + beta6*e2 + gamma6,
-                alpha4*e1 + beta4*e2 + gamma4,
-                e2);
+        p2.px[j] = c.alpha5*e1 + c.beta5*e2 + c.gamma5;
+        p2.py[j] = c.alpha6*e1 + c.beta6*e2 + c.gamma6;
+        p2.pz[j] = c.alpha4*e1 + c.beta4*e2 + c.gamma4;
+        p2.E[j] = e2;
 
-        neutrinos.push_back(std::make_pair(p1, p2));
+        n++;
     }
 
-    return neutrinos;
+    m_statistics.solved++;
+    m_statistics.n_solutions[n]++;
+
+    return n;
 }
 
-bool solveQuadratic(const double a, const double b, const double c, std::vector<double>& roots) {
+template<typename T>
+typename BasicNeutrinosSolver<T>::PairMasses BasicNeutrinosSolver<T>::pairMasses(T lx, T ly, T lz, T lE, T bx, T by, T bz, T bE) {
+    return { invariantMass2(lx, ly, lz, lE, bx, by, bz, bE), SQ(lE) - SQ(lx) - SQ(ly) - SQ(lz), SQ(bE) - SQ(bx) - SQ(by) - SQ(bz) };
+}
+
+template<typename T>
+bool BasicNeutrinosSolver<T>::passPreFilter(T b1z, T b2z, const PairMasses& pair1, const PairMasses& pair2, float top_mass, float w_mass) {
+
+    m_preFilterCounters.tested++;
+
+    if (std::abs(b1z) < m_preFilter.min_bjet_abs_pz || std::abs(b2z) < m_preFilter.min_bjet_abs_pz) {
+        m_preFilterCounters.rejected_bjet_pz++;
+        return false;
+    }
+
+    // See PreFilter::max_mlb for the kinematic endpoint
+    const T endpoint = T(top_mass * top_mass - w_mass * w_mass);
+    auto aboveMaximum = [this, endpoint](const PairMasses& pair) {
+        if (m_preFilter.max_mlb >= 0)
+            return pair.mlb_2 > SQ(m_preFilter.max_mlb);
+        return pair.mb_2 >= 0 && pair.mlb_2 > endpoint + pair.ml_2;
+    };
+
+    if (aboveMaximum(pair1) || aboveMaximum(pair2)) {
+        m_preFilterCounters.rejected_mlb++;
+        return false;
+    }
+
+    return true;
+}
+
+template<typename T>
+void BasicNeutrinosSolver<T>::computeCoefficients(const LorentzVector& lepton1_p4,
+        const LorentzVector& lepton2_p4,
+        const LorentzVector& bjet1_p4,
+        const LorentzVector& bjet2_p4,
+        const LorentzVector& met,
+        Coefficients& coefficients) const {
+
+    // pT = transverse total momentum of the visible particles
+    // It will be used to reconstruct neutrinos, but we want to take into account the measured ISR (pt_isr = - pt_met - pt_vis),
+    // so we add pt_isr to pt_vis in order to have pt_vis + pt_nu + pt_isr = 0 as it should be, i.e. pT = - pt_met.
+
+    T s13 = w_mass * w_mass;
+    T s134 = t_mass * t_mass;
+    T s25 = w_mass * w_mass;
+    T s256 = t_mass * t_mass;
+
+    fillCoefficients(
+            lepton1_p4.Px(), lepton1_p4.Py(), lepton1_p4.Pz(), lepton1_p4.E(),
+            bjet1_p4.Px(), bjet1_p4.Py(), bjet1_p4.Pz(), bjet1_p4.E(),
+            lepton2_p4.Px(), lepton2_p4.Py(), lepton2_p4.Pz(), lepton2_p4.E(),
+            bjet2_p4.Px(), bjet2_p4.Py(), bjet2_p4.Pz(), bjet2_p4.E(),
+            -met.Px(), -met.Py(),
+            s13, s134, s25, s256,
+            coefficients);
+}
+
+template<typename T>
+void BasicNeutrinosSolver<T>::computePairCoefficients(const LorentzVector& lepton_p4,
+        const LorentzVector& bjet_p4,
+        PairCoefficients& coefficients) const {
+
+    fillPairTerms(lepton_p4.Px(), lepton_p4.Py(), lepton_p4.Pz(), lepton_p4.E(),
+            bjet_p4.Px(), bjet_p4.Py(), bjet_p4.Pz(), bjet_p4.E(),
+            coefficients.terms);
+
+    coefficients.masses = pairMasses(lepton_p4.Px(), lepton_p4.Py(), lepton_p4.Pz(), lepton_p4.E(), bjet_p4.Px(), bjet_p4.Py(), bjet_p4.Pz(), bjet_p4.E());
+}
+
+template<typename T>
+uint8_t BasicNeutrinosSolver<T>::solvePairs(const PairCoefficients& pair1, const PairCoefficients& pair2, const T met_x, const T met_y,
+        const P4Array& p1, const P4Array& p2, const size_t offset) {
+
+    if (m_preFilter.enabled && !passPreFilter(pair1.terms.bz, pair2.terms.bz, pair1.masses, pair2.masses, t_mass, w_mass))
+        return 0;
+
+    T s13 = w_mass * w_mass;
+    T s134 = t_mass * t_mass;
+    T s25 = w_mass * w_mass;
+    T s256 = t_mass * t_mass;
+
+    NeutrinosSolverMassIndependentTerms<T> m;
+    Coefficients c;
+    combinePairTerms(pair1.terms, pair2.terms, -met_x, -met_y, m, c);
+    fillMassDependentCoefficients(m, s13, s134, s25, s256, c);
+
+    return solveConics(c, p1, p2, offset);
+}
+
+template<typename T>
+size_t BasicNeutrinosSolver<T>::getNeutrinos(const PairCoefficients& pair1,
+        const PairCoefficients& pair2,
+        const LorentzVector& met,
+        std::array<NeutrinosPair, maxSolutions>& neutrinos) {
+
+    ScopedTimer timer(m_timing, m_statistics.time);
+    m_statistics.calls++;
+
+    T buffer[8][maxSolutions];
+    const P4Array p1 = { buffer[0], buffer[1], buffer[2], buffer[3] };
+    const P4Array p2 = { buffer[4], buffer[5], buffer[6], buffer[7] };
+
+    const uint8_t n = solvePairs(pair1, pair2, met.Px(), met.Py(), p1, p2, 0);
+
+    for (uint8_t i = 0; i < n; i++) {
+        neutrinos[i] = std::make_pair(
+                LorentzVector(p1.px[i], p1.py[i], p1.pz[i], p1.E[i]),
+                LorentzVector(p2.px[i], p2.py[i], p2.pz[i], p2.E[i]));
+    }
+
+    return n;
+}
+
+template<typename T>
+void BasicNeutrinosSolver<T>::getNeutrinos(size_t n,
+        const PairCoefficients* pairs,
+        const uint32_t* pairs1,
+        const uint32_t* pairs2,
+        const ConstP4Array& met,
+        const P4Array& neutrino1_p4,
+        const P4Array& neutrino2_p4,
+        uint8_t* n_solutions) {
+
+    ScopedTimer timer(m_timing, m_statistics.time);
+    m_statistics.calls += n;
+
+    // The pairs are gathered through indices, which does not vectorize: the pre-filter is therefore applied first,
+    // saving the computation of the coefficients as well
+    for (size_t i = 0; i < n; i++)
+        n_solutions[i] = solvePairs(pairs[pairs1[i]], pairs[pairs2[i]], met.px[i], met.py[i], neutrino1_p4, neutrino2_p4, maxSolutions * i);
+}
+
+template<typename T>
+void BasicNeutrinosSolver<T>::computeMassIndependentCoefficients(const LorentzVector& lepton1_p4,
+        const LorentzVector& lepton2_p4,
+        const LorentzVector& bjet1_p4,
+        const LorentzVector& bjet2_p4,
+        const LorentzVector& met,
+        MassIndependentCoefficients& coefficients) const {
+
+    fillMassIndependentCoefficients(
+            lepton1_p4.Px(), lepton1_p4.Py(), lepton1_p4.Pz(), lepton1_p4.E(),
+            bjet1_p4.Px(), bjet1_p4.Py(), bjet1_p4.Pz(), bjet1_p4.E(),
+            lepton2_p4.Px(), lepton2_p4.Py(), lepton2_p4.Pz(), lepton2_p4.E(),
+            bjet2_p4.Px(), bjet2_p4.Py(), bjet2_p4.Pz(), bjet2_p4.E(),
+            -met.Px(), -met.Py(),
+            coefficients.terms,
+            coefficients.coefficients);
+
+    coefficients.masses1 = pairMasses(lepton1_p4.Px(), lepton1_p4.Py(), lepton1_p4.Pz(), lepton1_p4.E(), bjet1_p4.Px(), bjet1_p4.Py(), bjet1_p4.Pz(), bjet1_p4.E());
+    coefficients.masses2 = pairMasses(lepton2_p4.Px(), lepton2_p4.Py(), lepton2_p4.Pz(), lepton2_p4.E(), bjet2_p4.Px(), bjet2_p4.Py(), bjet2_p4.Pz(), bjet2_p4.E());
+}
+
+template<typename T>
+void BasicNeutrinosSolver<T>::getNeutrinos(const MassIndependentCoefficients& coefficients,
+        size_t n,
+        const Masses* masses,
+        const P4Array& neutrino1_p4,
+        const P4Array& neutrino2_p4,
+        uint8_t* n_solutions) {
+
+    ScopedTimer timer(m_timing, m_statistics.time);
+    m_statistics.calls += n;
+
+    // Only the gamma, linear and constant terms are computed for each mass hypothesis
+    Coefficients c = coefficients.coefficients;
+
+    for (size_t k = 0; k < n; k++) {
+        if (m_preFilter.enabled && !passPreFilter(coefficients.terms.p4z, coefficients.terms.p6z, coefficients.masses1, coefficients.masses2,
+                    masses[k].top, masses[k].w)) {
+            n_solutions[k] = 0;
+            continue;
+        }
+
+        const T s13 = masses[k].w * masses[k].w;
+        const T s134 = masses[k].top * masses[k].top;
+
+        fillMassDependentCoefficients(coefficients.terms, s13, s134, s13, s134, c);
+
+        n_solutions[k] = solveConics(c, neutrino1_p4, neutrino2_p4, maxSolutions * k);
+    }
+}
+
+template<typename T>
+size_t BasicNeutrinosSolver<T>::getNeutrinos(const LorentzVector& lepton1_p4,
+        const LorentzVector& lepton2_p4,
+        const LorentzVector& bjet1_p4,
+        const LorentzVector& bjet2_p4,
+        const LorentzVector& met,
+        std::array<NeutrinosPair, maxSolutions>& neutrinos) {
+
+    ScopedTimer timer(m_timing, m_statistics.time);
+    m_statistics.calls++;
+
+    if (m_preFilter.enabled && !passPreFilter(bjet1_p4.Pz(), bjet2_p4.Pz(),
+                pairMasses(lepton1_p4.Px(), lepton1_p4.Py(), lepton1_p4.Pz(), lepton1_p4.E(), bjet1_p4.Px(), bjet1_p4.Py(), bjet1_p4.Pz(), bjet1_p4.E()),
+                pairMasses(lepton2_p4.Px(), lepton2_p4.Py(), lepton2_p4.Pz(), lepton2_p4.E(), bjet2_p4.Px(), bjet2_p4.Py(), bjet2_p4.Pz(), bjet2_p4.E()),
+                t_mass, w_mass))
+        return 0;
+
+    Coefficients coefficients;
+    computeCoefficients(lepton1_p4, lepton2_p4, bjet1_p4, bjet2_p4, met, coefficients);
+
+    T buffer[8][maxSolutions];
+    const P4Array p1 = { buffer[0], buffer[1], buffer[2], buffer[3] };
+    const P4Array p2 = { buffer[4], buffer[5], buffer[6], buffer[7] };
+
+    const uint8_t n = solveConics(coefficients, p1, p2, 0);
+
+    for (uint8_t i = 0; i < n; i++) {
+        neutrinos[i] = std::make_pair(
+                LorentzVector(p1.px[i], p1.py[i], p1.pz[i], p1.E[i]),
+                LorentzVector(p2.px[i], p2.py[i], p2.pz[i], p2.E[i]));
+    }
+
+    return n;
+}
+
+template<typename T>
+std::vector<typename BasicNeutrinosSolver<T>::NeutrinosPair> BasicNeutrinosSolver<T>::getNeutrinos(const LorentzVector& lepton1_p4, 
+        const LorentzVector& lepton2_p4, 
+        const LorentzVector& bjet1_p4, 
+        const LorentzVector& bjet2_p4,
+        const LorentzVector& met) {
+
+    std::array<NeutrinosPair, maxSolutions> buffer;
+    const size_t n = getNeutrinos(lepton1_p4, lepton2_p4, bjet1_p4, bjet2_p4, met, buffer);
+
+    return std::vector<NeutrinosPair>(buffer.begin(), buffer.begin() + n);
+}
+
+template<typename T>
+void BasicNeutrinosSolver<T>::getNeutrinos(size_t n,
+        const ConstP4Array& lepton1_p4,
+        const ConstP4Array& lepton2_p4,
+        const ConstP4Array& bjet1_p4,
+        const ConstP4Array& bjet2_p4,
+        const ConstP4Array& met,
+        const P4Array& neutrino1_p4,
+        const P4Array& neutrino2_p4,
+        uint8_t* n_solutions) {
+
+    ScopedTimer timer(m_timing, m_statistics.time);
+    m_statistics.calls += n;
+
+    T s13 = w_mass * w_mass;
+    T s134 = t_mass * t_mass;
+    T s25 = w_mass * w_mass;
+    T s256 = t_mass * t_mass;
+
+    Coefficients coefficients[blockSize];
+
+    for (size_t begin = 0; begin < n; begin += blockSize) {
+        const size_t size = std::min(blockSize, n - begin);
+
+        const T* l1x = lepton1_p4.px + begin; const T* l1y = lepton1_p4.py + begin; const T* l1z = lepton1_p4.pz + begin; const T* l1E = lepton1_p4.E + begin;
+        const T* l2x = lepton2_p4.px + begin; const T* l2y = lepton2_p4.py + begin; const T* l2z = lepton2_p4.pz + begin; const T* l2E = lepton2_p4.E + begin;
+        const T* b1x = bjet1_p4.px + begin; const T* b1y = bjet1_p4.py + begin; const T* b1z = bjet1_p4.pz + begin; const T* b1E = bjet1_p4.E + begin;
+        const T* b2x = bjet2_p4.px + begin; const T* b2y = bjet2_p4.py + begin; const T* b2z = bjet2_p4.pz + begin; const T* b2E = bjet2_p4.E + begin;
+        const T* metx = met.px + begin; const T* mety = met.py + begin;
+
+        for (size_t i = 0; i < size; i++) {
+            fillCoefficients(
+                    l1x[i], l1y[i], l1z[i], l1E[i],
+                    b1x[i], b1y[i], b1z[i], b1E[i],
+                    l2x[i], l2y[i], l2z[i], l2E[i],
+                    b2x[i], b2y[i], b2z[i], b2E[i],
+                    -metx[i], -mety[i],
+                    s13, s134, s25, s256,
+                    coefficients[i]);
+        }
+
+        for (size_t i = 0; i < size; i++) {
+            // The coefficients are computed for the whole block, rejected inputs included, since this loop is vectorized;
+            // the pre-filter saves the intersection of the conics, where most of the time is spent
+            if (m_preFilter.enabled && !passPreFilter(b1z[i], b2z[i],
+                        pairMasses(l1x[i], l1y[i], l1z[i], l1E[i], b1x[i], b1y[i], b1z[i], b1E[i]),
+                        pairMasses(l2x[i], l2y[i], l2z[i], l2E[i], b2x[i], b2y[i], b2z[i], b2E[i]),
+                        t_mass, w_mass)) {
+                n_solutions[begin + i] = 0;
+                continue;
+            }
+
+            n_solutions[begin + i] = solveConics(coefficients[i], neutrino1_p4, neutrino2_p4, maxSolutions * (begin + i));
+        }
+    }
+}
+
+template<typename T>
+void BasicNeutrinosSolver<T>::getSmearedNeutrinos(const LorentzVector& lepton1_p4,
+        const LorentzVector& lepton2_p4,
+        const LorentzVector& bjet1_p4,
+        const LorentzVector& bjet2_p4,
+        const LorentzVector& met,
+        size_t n,
+        const Resolutions& resolutions,
+        uint64_t seed,
+        Samples& samples) {
+
+    samples.lepton1_p4.clear();
+    samples.lepton2_p4.clear();
+    samples.bjet1_p4.clear();
+    samples.bjet2_p4.clear();
+    samples.met.clear();
+
+    NormalStream stream(seed);
+
+    // Scale factors must stay positive: redraw in the (very unlikely) other case
+    auto jetScale = [&stream, &resolutions]() {
+        T scale;
+        do {
+            scale = T(1) + resolutions.jet * T(stream.next());
+        } while (scale <= T(0));
+        return scale;
+    };
+
+    for (size_t i = 0; i < n; i++) {
+        const LorentzVector smeared_bjet1_p4 = jetScale() * bjet1_p4;
+        const LorentzVector smeared_bjet2_p4 = jetScale() * bjet2_p4;
+
+        const T met_x = met.Px() - (smeared_bjet1_p4.Px() - bjet1_p4.Px()) - (smeared_bjet2_p4.Px() - bjet2_p4.Px()) + resolutions.met * T(stream.next());
+        const T met_y = met.Py() - (smeared_bjet1_p4.Py() - bjet1_p4.Py()) - (smeared_bjet2_p4.Py() - bjet2_p4.Py()) + resolutions.met * T(stream.next());
+
+        samples.lepton1_p4.push_back(lepton1_p4);
+        samples.lepton2_p4.push_back(lepton2_p4);
+        samples.bjet1_p4.push_back(smeared_bjet1_p4);
+        samples.bjet2_p4.push_back(smeared_bjet2_p4);
+        samples.met.push_back(LorentzVector(met_x, met_y, 0, std::sqrt(met_x*met_x + met_y*met_y)));
+    }
+
+    samples.neutrino1_p4.resize(maxSolutions * n);
+    samples.neutrino2_p4.resize(maxSolutions * n);
+    samples.n_solutions.resize(n);
+
+    getNeutrinos(n, samples.lepton1_p4.view(), samples.lepton2_p4.view(), samples.bjet1_p4.view(), samples.bjet2_p4.view(), samples.met.view(),
+            samples.neutrino1_p4.mutableView(), samples.neutrino2_p4.mutableView(), samples.n_solutions.data());
+}
+
+template<typename T>
+bool solveQuadratic(const T a, const T b, const T c, BasicRoots<T>& roots) {
 
     if(!a){
         if(!b){
@@ -139,14 +702,14 @@ bool solveQuadratic(const double a, const double b, const double c, std::vector<
         return true;
     }
 
-    const double rho = SQ(b) - 4.*a*c;
+    const T rho = SQ(b) - T(4)*a*c;
 
-    if(rho >= 0.){
-        if(b == 0.){
-            roots.push_back( std::sqrt(rho)/(2.*a) );
-            roots.push_back( -std::sqrt(rho)/(2.*a) );
+    if(rho >= T(0)){
+        if(b == T(0)){
+            roots.push_back( std::sqrt(rho)/(T(2)*a) );
+            roots.push_back( -std::sqrt(rho)/(T(2)*a) );
         }else{
-            const double x = -0.5*(b + std::copysign(std::sqrt(rho), b));
+            const T x = -T(0.5)*(b + std::copysign(std::sqrt(rho), b));
             roots.push_back(x/a);
             roots.push_back(c/x);
         }
@@ -156,35 +719,36 @@ bool solveQuadratic(const double a, const double b, const double c, std::vector<
     }
 }
 
-bool solveCubic(const double a, const double b, const double c, const double d, std::vector<double>& roots) {
+template<typename T>
+bool solveCubic(const T a, const T b, const T c, const T d, BasicRoots<T>& roots) {
 
     if(a == 0)
         return solveQuadratic(b, c, d, roots);
 
-    const double an = b/a;
-    const double bn = c/a;
-    const double cn = d/a;
+    const T an = b/a;
+    const T bn = c/a;
+    const T cn = d/a;
 
-    const double Q = SQ(an)/9. - bn/3.;
-    const double R = CB(an)/27. - an*bn/6. + cn/2.;
+    const T Q = SQ(an)/T(9) - bn/T(3);
+    const T R = CB(an)/T(27) - an*bn/T(6) + cn/T(2);
 
     if( SQ(R) < CB(Q) ){
-        const double theta = std::acos( R/std::sqrt(CB(Q)) )/3.;
+        const T theta = std::acos( R/std::sqrt(CB(Q)) )/T(3);
 
-        roots.push_back( -2. * std::sqrt(Q) * std::cos(theta) - an/3. );
-        roots.push_back( -2. * std::sqrt(Q) * cosXpm2PI3(theta, 1.) - an/3. );
-        roots.push_back( -2. * std::sqrt(Q) * cosXpm2PI3(theta, -1.) - an/3. );
+        roots.push_back( -T(2) * std::sqrt(Q) * std::cos(theta) - an/T(3) );
+        roots.push_back( -T(2) * std::sqrt(Q) * cosXpm2PI3(theta, T(1)) - an/T(3) );
+        roots.push_back( -T(2) * std::sqrt(Q) * cosXpm2PI3(theta, -T(1)) - an/T(3) );
     }else{
-        const double A = - std::copysign(std::cbrt(std::abs(R) + std::sqrt( SQ(R) - CB(Q))), R);
+        const T A = - std::copysign(std::cbrt(std::abs(R) + std::sqrt( SQ(R) - CB(Q))), R);
 
-        double B;
+        T B;
 
-        if(A == 0.)
-            B = 0.;
+        if(A == T(0))
+            B = T(0);
         else
             B = Q/A;
 
-        const double x = A + B - an/3.;
+        const T x = A + B - an/T(3);
 
         roots.push_back(x);
         roots.push_back(x);
@@ -194,24 +758,25 @@ bool solveCubic(const double a, const double b, const double c, const double d,
     return true;
 }
 
-bool solveQuartic(const double a, const double b, const double c, const double d, const double e, std::vector<double>& roots) {
+template<typename T>
+bool solveQuartic(const T a, const T b, const T c, const T d, const T e, BasicRoots<T>& roots) {
 
     if(!a)
         return solveCubic(b, c, d, e, roots);
 
     if(!b && !c && !d){
-        roots.push_back(0.);
-        roots.push_back(0.);
-        roots.push_back(0.);
-        roots.push_back(0.);
+        roots.push_back(T(0));
+        roots.push_back(T(0));
+        roots.push_back(T(0));
+        roots.push_back(T(0));
     }else{
-        const double an = b/a;
-        const double bn = c/a - (3./8.) * SQ(b/a);
-        const double cn = CB(0.5*b/a) - 0.5*b*c/SQ(a) + d/a;
-        const double dn = -3.*QU(0.25*b/a) + e/a - 0.25*b*d/SQ(a) + c*SQ(b/4.)/CB(a);
+        const T an = b/a;
+        const T bn = c/a - (T(3)/T(8)) * SQ(b/a);
+        const T cn = CB(T(0.5)*b/a) - T(0.5)*b*c/SQ(a) + d/a;
+        const T dn = -T(3)*QU(T(0.25)*b/a) + e/a - T(0.25)*b*d/SQ(a) + c*SQ(b/T(4))/CB(a);
 
-        std::vector<double> res;
-        solveCubic(1., 2.*bn, SQ(bn) - 4.*dn, -SQ(cn), res);
+        BasicRoots<T> res;
+        solveCubic(T(1), T(2)*bn, SQ(bn) - T(4)*dn, -SQ(cn), res);
         short pChoice = -1;
 
         for(unsigned short i = 0; i<res.size(); ++i){
@@ -225,12 +790,12 @@ bool solveQuartic(const double a, const double b, const double c, const double d
             return false;
         }
 
-        const double p = std::sqrt(res[pChoice]);
-        solveQuadratic(p, SQ(p), 0.5*( p*(bn + res[pChoice]) - cn ), roots);
-        solveQuadratic(p, -SQ(p), 0.5*( p*(bn + res[pChoice]) + cn ), roots);
+        const T p = std::sqrt(res[pChoice]);
+        solveQuadratic(p, SQ(p), T(0.5)*( p*(bn + res[pChoice]) - cn ), roots);
+        solveQuadratic(p, -SQ(p), T(0.5)*( p*(bn + res[pChoice]) + cn ), roots);
 
         for(unsigned short i = 0; i<roots.size(); ++i)
-            roots[i] -= an/4.;
+            roots[i] -= an/T(4);
     }
 
     size_t nRoots = roots.size();
@@ -238,17 +803,23 @@ bool solveQuartic(const double a, const double b, const double c, const double d
     return nRoots > 0;
 }
 
-bool solve2Quads(const double a20, const double a02, const double a11, const double a10, const double a01, const double a00, const double b20, const double b02, const double b11, const double b10, const double b01, const double b00, std::vector<double>& E1, std::vector<double>& E2){
+template<typename T>
+bool solve2Quads(const T a20, const T a02, const T a11, const T a10, const T a01, const T a00, const T b20, const T b02, const T b11, const T b10, const T b01, const T b00, BasicRoots<T>& E1, BasicRoots<T>& E2, ConicsBranchCounters* counters){
 
     // The procedure used in this function relies on a20 != 0 or b20 != 0
-    if(a20 == 0. && b20 == 0.){
+    if(a20 == T(0) && b20 == T(0)){
 
-        if(a02 != 0. || b02 != 0.){
+        if(a02 != T(0) || b02 != T(0)){
             // Swapping E1 <-> E2 should suffice!
             return solve2Quads(a02, a20, a11, a01, a10, a00,
                     b02, b20, b11, b01, b10, b00,
-                    E2, E1);
+                    E2, E1, counters);
         }else{
+            if(counters){
+                counters->quads_deg++;
+                if(a11 == T(0) && b11 == T(0))
+                    counters->linear++;
+            }
             return solve2QuadsDeg(a11, a10, a01, a00,
                     b11, b10, b01, b00,
                     E1, E2);
@@ -256,35 +827,43 @@ bool solve2Quads(const double a20, const double a02, const double a11, const dou
 
     }
 
-    const double alpha = b20*a02-a20*b02;
-    const double beta = b20*a11-a20*b11;
-    const double gamma = b20*a10-a20*b10;
-    const double delta = b20*a01-a20*b01;
-    const double omega = b20*a00-a20*b00;
+    const Elimination<T> elimination = eliminateE1(a20, a02, a11, a10, a01, a00, b20, b02, b11, b10, b01, b00);
+
+    const T alpha = elimination.alpha;
+    const T beta = elimination.beta;
+    const T gamma = elimination.gamma;
+    const T delta = elimination.delta;
+    const T omega = elimination.omega;
 
-    const double a = a20*SQ(alpha) + a02*SQ(beta) - a11*alpha*beta;
-    const double b = 2.*a20*alpha*delta - a11*( alpha*gamma + delta*beta ) - a10*alpha*beta + 2.*a02*beta*gamma + a01*SQ(beta);
-    const double c = a20*SQ(delta) + 2.*a20*alpha*omega - a11*( delta*gamma + omega*beta ) - a10*( alpha*gamma + delta*beta )
-        + a02*SQ(gamma) + 2.*a01*beta*gamma + a00*SQ(beta);
-    const double d = 2.*a20*delta*omega - a11*omega*gamma - a10*( delta*gamma + omega*beta ) + a01*SQ(gamma) + 2.*a00*beta*gamma;
-    const double e = a20*SQ(omega) - a10*omega*gamma + a00*SQ(gamma);
+    const T a = elimination.a;
+    const T b = elimination.b;
+    const T c = elimination.c;
+    const T d = elimination.d;
+    const T e = elimination.e;
 
     solveQuartic(a, b, c, d, e, E2);
 
+    // Roots e2 without any corresponding e1 are dropped by compacting E2 in place: n is the number of roots kept so far
+    size_t n = 0;
+
     for(unsigned short i = 0; i < E2.size(); ++i){
 
-        const double e2 = E2[i];
+        const T e2 = E2[i];
 
-        if(beta*e2 + gamma != 0.){
+        if(counters && beta*e2 + gamma == T(0))
+            counters->zero_denominator++;
+
+        if(beta*e2 + gamma != T(0)){
             // Everything OK
 
-            const double e1 = -(alpha * SQ(e2) + delta*e2 + omega)/(beta*e2 + gamma);
+            const T e1 = -(alpha * SQ(e2) + delta*e2 + omega)/(beta*e2 + gamma);
             E1.push_back(e1);
+            E2[n++] = e2;
 
-        }else if(alpha*SQ(e2) + delta*e2 + omega == 0.){
+        }else if(alpha*SQ(e2) + delta*e2 + omega == T(0)){
             // Up to two solutions for e1
 
-            std::vector<double> e1;
+            BasicRoots<T> e1;
 
             if( !solveQuadratic(a20, a11*e2 + a10, a02*SQ(e2) + a01*e2 + a00, e1) ){
 
@@ -294,11 +873,13 @@ bool solve2Quads(const double a20, const double a02, const double a11, const dou
                     return false;
                 }
 
+                E2[n++] = e2;
+
             }else{
                 // We have either a double, or two roots for e1
                 // In this case, e2 must be twice degenerate!
                 // Since in E2 degenerate roots are grouped, E2[i+1] shoud exist and be equal to e2
-                // We then go straight for i+2.
+                // We then go straight for i+2
 
                 if(i < E2.size() - 1){
 
@@ -310,6 +891,8 @@ bool solve2Quads(const double a20, const double a02, const double a11, const dou
 
                     E1.push_back(e1[0]);
                     E1.push_back(e1[1]);
+                    E2[n++] = e2;
+                    E2[n++] = e2;
                     ++i;
                     continue;
 
@@ -321,20 +904,20 @@ bool solve2Quads(const double a20, const double a02, const double a11, const dou
 
             }
 
-        }else{
-            // There is no solution given this e2
-            E2.erase(E2.begin() + i);
-            --i;
         }
+        // else: there is no solution given this e2
 
     }
 
+    E2.resize(n);
+
     return true;
 }
 
-bool solve2QuadsDeg(const double a11, const double a10, const double a01, const double a00, const double b11, const double b10, const double b01, const double b00, std::vector<double>& E1, std::vector<double>& E2) {
+template<typename T>
+bool solve2QuadsDeg(const T a11, const T a10, const T a01, const T a00, const T b11, const T b10, const T b01, const T b00, BasicRoots<T>& E1, BasicRoots<T>& E2) {
 
-    if(a11 == 0. && b11 == 0.)
+    if(a11 == T(0) && b11 == T(0))
         return solve2Linear(a10, a01, a00, b10, b01, b00, E1, E2);
 
     bool result = solveQuadratic(a11*(b11*a10-a11*b10),
@@ -346,49 +929,57 @@ bool solve2QuadsDeg(const double a11, const double a10, const double a01, const
         return false;
     }
 
+    // Roots e1 without any corresponding e2 are dropped by compacting E1 in place: n is the number of roots kept so far
+    size_t n = 0;
+
     for(unsigned short i=0; i<E1.size(); ++i){
 
-        double denom = a11*E1[i] + a01;
+        const T e1 = E1[i];
+        T denom = a11*e1 + a01;
 
         if(denom != 0){
-            E2.push_back( -(a10*E1[i] + a00)/denom );
+            E2.push_back( -(a10*e1 + a00)/denom );
 
         }else{
             denom = b11*a01 - a11*b01;
-            if(denom != 0.){
-                E2.push_back( -( (b11*a10 - a11*b10)*E1[i] + b11*a00 - a11*b00 )/denom );
+            if(denom != T(0)){
+                E2.push_back( -( (b11*a10 - a11*b10)*e1 + b11*a00 - a11*b00 )/denom );
             }else{
-                denom = b11*E1[i] + b01;
-                if(denom != 0.){
-                    E2.push_back( -(b10*E1[i] + b00)/denom );
+                denom = b11*e1 + b01;
+                if(denom != T(0)){
+                    E2.push_back( -(b10*e1 + b00)/denom );
                 }else{
-                    E1.erase(E1.begin() + i);
-                    --i;
+                    continue;
                 }
             }
         }
 
+        E1[n++] = e1;
+
     }
 
-    return E1.size();
+    E1.resize(n);
+
+    return n;
 }
 
-bool solve2Linear(const double a10, const double a01, const double a00, const double b10, const double b01, const double b00, std::vector<double>& E1, std::vector<double>& E2) {
+template<typename T>
+bool solve2Linear(const T a10, const T a01, const T a00, const T b10, const T b01, const T b00, BasicRoots<T>& E1, BasicRoots<T>& E2) {
 
-    const double det = a10*b01 - b10*a01;
+    const T det = a10*b01 - b10*a01;
 
-    if(det == 0.){
-        if(a00 != 0. || b00 != 0.){
+    if(det == T(0)){
+        if(a00 != T(0) || b00 != T(0)){
             return false;
         }else{
             return false;
         }
     }
 
-    const double e2 = (b10*a00-a10*b00)/det;
+    const T e2 = (b10*a00-a10*b00)/det;
     E2.push_back(e2);
-    double e1;
-    if(a10 == 0.)
+    T e1;
+    if(a10 == T(0))
         e1 = -(b00 + b01*e2)/b10;
     else
         e1 = -(a00 + a01*e2)/a10;
@@ -396,3 +987,72 @@ bool solve2Linear(const double a10, const double a01, const double a00, const do
 
     return true;
 }
+
+#define INSTANTIATE_SOLVERS(T) \
+    template bool solveQuadratic(const T, const T, const T, BasicRoots<T>&); \
+    template bool solveCubic(const T, const T, const T, const T, BasicRoots<T>&); \
+    template bool solveQuartic(const T, const T, const T, const T, const T, BasicRoots<T>&); \
+    template bool solve2Quads(const T, const T, const T, const T, const T, const T, const T, const T, const T, const T, const T, const T, BasicRoots<T>&, BasicRoots<T>&, ConicsBranchCounters*); \
+    template bool solve2QuadsDeg(const T, const T, const T, const T, const T, const T, const T, const T, BasicRoots<T>&, BasicRoots<T>&); \
+    template bool solve2Linear(const T, const T, const T, const T, const T, const T, BasicRoots<T>&, BasicRoots<T>&);
+
+INSTANTIATE_SOLVERS(float)
+INSTANTIATE_SOLVERS(double)
+
+#undef INSTANTIATE_SOLVERS
+
+namespace {
+
+    void append(const Roots& roots, std::vector<double>& result) {
+        result.insert(result.end(), roots.begin(), roots.end());
+    }
+
+}
+
+bool solveQuadratic(const double a, const double b, const double c, std::vector<double>& roots) {
+    Roots r;
+    const bool result = solveQuadratic(a, b, c, r);
+    append(r, roots);
+    return result;
+}
+
+bool solveCubic(const double a, const double b, const double c, const double d, std::vector<double>& roots) {
+    Roots r;
+    const bool result = solveCubic(a, b, c, d, r);
+    append(r, roots);
+    return result;
+}
+
+bool solveQuartic(const double a, const double b, const double c, const double d, const double e, std::vector<double>& roots) {
+    Roots r;
+    const bool result = solveQuartic(a, b, c, d, e, r);
+    append(r, roots);
+    return result;
+}
+
+bool solve2Quads(const double a20, const double a02, const double a11, const double a10, const double a01, const double a00, const double b20, const double b02, const double b11, const double b10, const double b01, const double b00, std::vector<double>& E1, std::vector<double>& E2) {
+    Roots r1, r2;
+    const bool result = solve2Quads(a20, a02, a11, a10, a01, a00, b20, b02, b11, b10, b01, b00, r1, r2);
+    append(r1, E1);
+    append(r2, E2);
+    return result;
+}
+
+bool solve2QuadsDeg(const double a11, const double a10, const double a01, const double a00, const double b11, const double b10, const double b01, const double b00, std::vector<double>& E1, std::vector<double>& E2) {
+    Roots r1, r2;
+    const bool result = solve2QuadsDeg(a11, a10, a01, a00, b11, b10, b01, b00, r1, r2);
+    append(r1, E1);
+    append(r2, E2);
+    return result;
+}
+
+bool solve2Linear(const double a10, const double a01, const double a00, const double b10, const double b01, const double b00, std::vector<double>& E1, std::vector<double>& E2) {
+    Roots r1, r2;
+    const bool result = solve2Linear(a10, a01, a00, b10, b01, b00, r1, r2);
+    append(r1, E1);
+    append(r2, E2);
+    return result;
+}
+
+template class BasicNeutrinosSolver<float>;
+template class BasicNeutrinosSolver<double>;
@@ -23,9 +23,13 @@ namespace TTAnalysis {
     std::vector<float> dummy17;
     TTAnalysis::TTBar dummy18;
     std::vector<TTAnalysis::TTBar> dummy19;
-    std::vector<std::vector<TTAnalysis::TTBar>> dummy20;
-    std::vector<std::vector<std::vector<TTAnalysis::TTBar>>> dummy21;
     TTAnalysis::GenParticle dummy22;
     std::vector<TTAnalysis::GenParticle> dummy23;
+    TTAnalysis::LepIDFlags dummy24;
+    TTAnalysis::LepIsoFlags dummy25;
+    TTAnalysis::LepLepIDFlags dummy26;
+    TTAnalysis::JetIDFlags dummy27;
+    TTAnalysis::JetJetBWPFlags dummy28;
+    TTAnalysis::LepIDIsoDR dummy29;
   };
 }
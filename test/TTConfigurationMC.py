@@ -42,6 +42,23 @@ framework.addAnalyzer('tt', cms.PSet(
 
             hltDRCut = cms.untracked.double(0.3), # DeltaR cut for trigger matching
             hltDPtCut = cms.untracked.double(0.5), #Delta(Pt)/Pt cut for trigger matching
+
+            neutrinosSolverSmearingSamples = cms.untracked.uint32(0), # Smeared variations solved for candidates without solution (0 to disable)
+            neutrinosSolverJetResolution = cms.untracked.double(0.1), # Relative b-jet energy resolution used for the smearing
+            neutrinosSolverMetResolution = cms.untracked.double(20), # Resolution (GeV) on each MET component used for the smearing
+            neutrinosSolverPreFilter = cms.untracked.bool(True), # Skip the inputs which cannot have any solution
+            neutrinosSolverMaxMlb = cms.untracked.double(-1), # Maximal m(l,b) in the pre-filter; negative for the kinematic endpoint sqrt(mt^2 - mW^2 + ml^2)
+            neutrinosSolverMinBJetAbsPz = cms.untracked.double(1e-3), # Minimal b-jet |pz| in the pre-filter
+            neutrinosSolverStatisticsBranches = cms.untracked.bool(False), # Store the statistics of the neutrinos solver for each event
+            neutrinosSolverParallelMinCandidates = cms.untracked.uint32(0), # Minimal number of candidates to solve an event in parallel TBB tasks (0 to disable)
+            concurrentStages = cms.untracked.bool(False), # Run the independent stages of the event processing concurrently in a TBB flow graph
+            compactIndexBranches = cms.untracked.bool(False), # Write the index list branches as flat NAME_indices and NAME_offsets arrays (see interface/CompactIndexLists.h)
+            deltaEncodeIndexBranches = cms.untracked.bool(False), # With compactIndexBranches, store NAME_deltas (differences between consecutive indices of a list) instead of NAME_indices
+            workingPoints = cms.untracked.vstring(), # Combinations of working points to compute, e.g. 'Lep_IDTT_IsoTT_BMM'; empty for all of them
+            maxLeptonsForCombinatorics = cms.untracked.uint32(0), # Only combine the N leading leptons in pt into DiLeptons (0 for all of them)
+            maxJetsByPtForCombinatorics = cms.untracked.uint32(0), # Combine the N leading jets in pt into DiJets, together with the ones below (0 for no cap)
+            maxJetsByCSVv2ForCombinatorics = cms.untracked.uint32(0), # Combine the N leading jets in CSVv2 into DiJets, together with the ones above (0 for no cap)
+            maxDiLepDiJets = cms.untracked.uint32(0), # Maximal number of DiLepDiJets per event (0 for no limit); the `combinatoricsCaps` branch records the caps applied
             ),
         categories_parameters = cms.PSet(
             MllCutSF = cms.untracked.double(20),